@@ -31,7 +31,6 @@
 #include <iostream>
 #include <functional>
 #include <filesystem>
-#include <random>
 #include <sstream>
 
 #include "opengl-example.h"
@@ -301,20 +300,17 @@ bool openglExample::init()
 
     mDullahan = new dullahan();
 
-    // Modern way of generating random numbers - need this for making the CEF root_cache_folder unique
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distrib(100000, 999999);
-    int random_number = distrib(gen);
-
-    // As of CEF 139, the root cache folder must be unique and
-    // an absolute path - std::Filesystem to the rescue
-    std::filesystem::path root_cache_path = std::filesystem::absolute("./opengl-example-profile") / std::to_string(random_number);
-    std::filesystem::path log_path = root_cache_path / "opengl-example-cef.log";
+    // As of CEF 139, the root cache folder must be unique to each running instance -
+    // Dullahan leases one of the profiles kept here so the next run reuses it (and
+    // its cache) and old ones are cleaned up instead of piling up
+    std::filesystem::path profile_pool_path = std::filesystem::absolute("./opengl-example-profile");
+    std::filesystem::path log_path = profile_pool_path / "opengl-example-cef.log";
 
     dullahan::dullahan_settings settings;
     settings.log_file = log_path.string();
-    settings.root_cache_path = root_cache_path.string();
+    settings.profile_pool_path = profile_pool_path.string();
+    settings.profile_pool_max_profiles = 2;
+    settings.profile_pool_max_size_mb = 512;
     settings.initial_height = mTextureWidth;
     settings.initial_width = mTextureHeight;
     settings.disable_gpu = false;
@@ -327,7 +323,7 @@ bool openglExample::init()
     {
         resizeBrowser(mTextureWidth, mTextureHeight);
 
-        mDullahan->setOnPageChangedCallback(std::bind(&openglExample::onPageChanged, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5));
+        mDullahan->setOnPageChangedRegionsCallback(std::bind(&openglExample::onPageChangedRegions, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
         mDullahan->setOnRequestExitCallback(std::bind(&openglExample::onRequestExitCallback, this));
         mDullahan->setOnJStoCPPMsgCallback(std::bind(&openglExample::onJStoCPPMsgCallback, this, std::placeholders::_1, std::placeholders::_2));
         
@@ -458,8 +454,9 @@ bool openglExample::draw(int* tx, int* ty)
     return hit_browser;
 }
 
-// Triggered when browser page content changes
-void openglExample::onPageChanged(const unsigned char* pixels, int x, int y, const int width, const int height)
+// Triggered when browser page content changes - only the dirty
+// regions of the texture are uploaded
+void openglExample::onPageChangedRegions(const unsigned char* pixels, const int width, const int height, const std::vector<dullahan::dullahan_rect>& dirty_rects)
 {
     if (width != mTextureWidth || height != mTextureHeight)
     {
@@ -473,7 +470,26 @@ void openglExample::onPageChanged(const unsigned char* pixels, int x, int y, con
     resizeBrowser(width, height);
 
     glBindTexture(GL_TEXTURE_2D, (GLuint)mTextureId);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)mTextureWidth, (GLsizei)mTextureHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+    for (const dullahan::dullahan_rect& rect : dirty_rects)
+    {
+        // the first update after the texture is (re)created always covers the whole page
+        if (rect.width == width && rect.height == height)
+        {
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei)mTextureWidth, (GLsizei)mTextureHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+        }
+        else
+        {
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, rect.x);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, rect.y);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
 }
 
 // Triggered by Dullahan when cleanup is complete and it's okay to exit
@@ -46,7 +46,7 @@
 #include <GLFW/glfw3.h>
 #endif
 
-class dullahan;
+#include "dullahan.h"
 
 class openglExample
 {
@@ -67,7 +67,7 @@ class openglExample
         bool reset();
 
         // callbacks
-        void onPageChanged(const unsigned char* pixels, int x, int y, const int width, const int height);
+        void onPageChangedRegions(const unsigned char* pixels, const int width, const int height, const std::vector<dullahan::dullahan_rect>& dirty_rects);
         void onRequestExitCallback();
         std::string onJStoCPPMsgCallback(const std::string id, const std::string msg);
 
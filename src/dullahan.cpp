@@ -26,9 +26,27 @@
 
 #include "dullahan.h"
 #include "dullahan_impl.h"
+#include "dullahan_engine_impl.h"
 #include "dullahan_debug.h"
 #include "dullahan_callback_manager.h"
 
+namespace
+{
+    // make a call on CEF's UI thread and hand back what it returned - see
+    // dullahan_impl::wait(..). Calls that return nothing are just posted
+    template <typename T>
+    T waitFor(dullahan_impl* impl, std::function<T()> call)
+    {
+        T result = T();
+        impl->wait([&result, &call]()
+        {
+            result = call();
+        });
+
+        return result;
+    }
+}
+
 dullahan::dullahan() :
     mImpl(new dullahan_impl())
 {
@@ -45,6 +63,21 @@ bool dullahan::init(dullahan_settings& user_settings)
     return mImpl->init(user_settings);
 }
 
+bool dullahan::init(dullahan_engine& engine, dullahan_settings& user_settings)
+{
+    return mImpl->init(engine.mImpl, user_settings);
+}
+
+bool dullahan::initAsync(dullahan_settings& user_settings)
+{
+    return mImpl->initAsync(user_settings);
+}
+
+bool dullahan::initAsync(dullahan_engine& engine, dullahan_settings& user_settings)
+{
+    return mImpl->initAsync(engine.mImpl, user_settings);
+}
+
 void dullahan::shutdown()
 {
     mImpl->shutdown();
@@ -52,22 +85,71 @@ void dullahan::shutdown()
 
 void dullahan::requestExit()
 {
-    mImpl->requestExit();
+    mImpl->post([=, this]()
+    {
+        mImpl->requestExit();
+    });
+}
+
+void dullahan::getShutdownStats(dullahan_shutdown_stats& stats)
+{
+    mImpl->wait([&]()
+    {
+        mImpl->getShutdownStats(stats);
+    });
 }
 
 void dullahan::getSize(int& width, int& height)
 {
-    mImpl->getSize(width, height);
+    mImpl->wait([&]()
+    {
+        mImpl->getSize(width, height);
+    });
 }
 
 void dullahan::setSize(int width, int height)
 {
-    mImpl->setSize(width, height);
+    mImpl->post([=, this]()
+    {
+        mImpl->setSize(width, height);
+    });
 }
 
 int dullahan::getDepth()
 {
-    return mImpl->getDepth();
+    return waitFor<int>(mImpl.get(), [&]()
+    {
+        return mImpl->getDepth();
+    });
+}
+
+void dullahan::setPixelBuffer(const dullahan_pixel_buffer& buffer)
+{
+    mImpl->wait([&]()
+    {
+        mImpl->setPixelBuffer(buffer);
+    });
+}
+
+bool dullahan::acquireLatestFrame(dullahan_frame& frame)
+{
+    return mImpl->acquireLatestFrame(frame);
+}
+
+bool dullahan::acquireFrame(uint64_t last_sequence, dullahan_frame& frame)
+{
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->acquireFrame(last_sequence, frame);
+    });
+}
+
+size_t dullahan::getPixelMemoryFootprint()
+{
+    return waitFor<size_t>(mImpl.get(), [&]()
+    {
+        return mImpl->getPixelMemoryFootprint();
+    });
 }
 
 void dullahan::run()
@@ -80,39 +162,85 @@ void dullahan::update()
     mImpl->update();
 }
 
+dullahan::dullahan_update_result dullahan::update(int64_t budget_us)
+{
+    return mImpl->update(budget_us);
+}
+
+void dullahan::getUpdateStats(dullahan_update_stats& stats)
+{
+    mImpl->getUpdateStats(stats);
+}
+
+void dullahan::resetUpdateStats()
+{
+    mImpl->resetUpdateStats();
+}
+
+int dullahan::getUpdateDelay()
+{
+    return mImpl->getUpdateDelay();
+}
+
+int dullahan::getUpdateFd()
+{
+    return mImpl->getUpdateFd();
+}
+
 bool dullahan::canGoBack()
 {
-    return mImpl->canGoBack();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->canGoBack();
+    });
 }
 
 void dullahan::goBack()
 {
-    mImpl->goBack();
+    mImpl->post([=, this]()
+    {
+        mImpl->goBack();
+    });
 }
 
 bool dullahan::canGoForward()
 {
-    return mImpl->canGoForward();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->canGoForward();
+    });
 }
 
 void dullahan::goForward()
 {
-    mImpl->goForward();
+    mImpl->post([=, this]()
+    {
+        mImpl->goForward();
+    });
 }
 
 bool dullahan::isLoading()
 {
-    return mImpl->isLoading();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->isLoading();
+    });
 }
 
 void dullahan::reload(const bool ignore_cache)
 {
-    mImpl->reload(ignore_cache);
+    mImpl->post([=, this]()
+    {
+        mImpl->reload(ignore_cache);
+    });
 }
 
 void dullahan::stop()
 {
-    mImpl->stop();
+    mImpl->post([=, this]()
+    {
+        mImpl->stop();
+    });
 }
 
 const std::string dullahan::dullahan_cef_version(bool show_bitwidth)
@@ -142,19 +270,28 @@ std::string dullahan::makeCompatibleUserAgentString(const std::string base)
 
 void dullahan::mouseMove(int x, int y)
 {
-    mImpl->mouseMove(x, y);
+    mImpl->post([=, this]()
+    {
+        mImpl->mouseMove(x, y);
+    });
 }
 
 void dullahan::mouseButton(EMouseButton mouse_button,
                            EMouseEvent mouse_event,
                            int x, int y)
 {
-    mImpl->mouseButton(mouse_button, mouse_event, x, y);
+    mImpl->post([=, this]()
+    {
+        mImpl->mouseButton(mouse_button, mouse_event, x, y);
+    });
 }
 
 void dullahan::mouseWheel(int x, int y, int delta_x, int delta_y)
 {
-    mImpl->mouseWheel(x, y, delta_x, delta_y);
+    mImpl->post([=, this]()
+    {
+        mImpl->mouseWheel(x, y, delta_x, delta_y);
+    });
 }
 
 #ifndef __linux__
@@ -162,12 +299,18 @@ void dullahan::nativeKeyboardEventWin(uint32_t msg,
                                       uint32_t wparam,
                                       uint64_t lparam)
 {
-    mImpl->nativeKeyboardEventWin(msg, wparam, lparam);
+    mImpl->post([=, this]()
+    {
+        mImpl->nativeKeyboardEventWin(msg, wparam, lparam);
+    });
 }
 
 void dullahan::nativeKeyboardEventOSX(void* event)
 {
-    mImpl->nativeKeyboardEventOSX(event);
+    mImpl->post([=, this]()
+    {
+        mImpl->nativeKeyboardEventOSX(event);
+    });
 }
 
 void dullahan::nativeKeyboardEventOSX(EKeyEvent event_type,
@@ -177,18 +320,27 @@ void dullahan::nativeKeyboardEventOSX(EKeyEvent event_type,
                                       uint32_t event_umodchars,
                                       bool event_isrepeat)
 {
-    mImpl->nativeKeyboardEventOSX(event_type, event_modifiers,
-                                  event_keycode, event_chars,
-                                  event_umodchars, event_isrepeat);
+    mImpl->post([=, this]()
+    {
+        mImpl->nativeKeyboardEventOSX(event_type, event_modifiers,
+                                      event_keycode, event_chars,
+                                      event_umodchars, event_isrepeat);
+    });
 }
 #else
 void dullahan::nativeKeyboardEvent(dullahan::EKeyEvent key_event, uint32_t native_scan_code, uint32_t native_virtual_key, uint32_t native_modifiers)
 {
-    mImpl->nativeKeyboardEvent(key_event, native_scan_code, native_virtual_key, native_modifiers);
+    mImpl->post([=, this]()
+    {
+        mImpl->nativeKeyboardEvent(key_event, native_scan_code, native_virtual_key, native_modifiers);
+    });
 }
 void dullahan::nativeKeyboardEventSDL2(dullahan::EKeyEvent key_event, uint32_t key_data, uint32_t key_modifiers, bool keypad_input)
 {
-    mImpl->nativeKeyboardEventSDL2(key_event, key_data, key_modifiers, keypad_input);
+    mImpl->post([=, this]()
+    {
+        mImpl->nativeKeyboardEventSDL2(key_event, key_data, key_modifiers, keypad_input);
+    });
 }
 #endif
 
@@ -196,108 +348,227 @@ void dullahan::navigate(const std::string url)
 {
     if (url.length() > 0)
     {
-        mImpl->navigate(url);
+        mImpl->post([=, this]()
+        {
+            mImpl->navigate(url);
+        });
     }
 }
 
 void dullahan::setFocus()
 {
-    mImpl->setFocus();
+    mImpl->post([=, this]()
+    {
+        mImpl->setFocus();
+    });
 }
 
 void dullahan::setPageZoom(const double zoom_val)
 {
-    mImpl->setPageZoom(zoom_val);
+    mImpl->post([=, this]()
+    {
+        mImpl->setPageZoom(zoom_val);
+    });
+}
+
+void dullahan::setVisible(bool visible)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->setVisible(visible);
+    });
+}
+
+bool dullahan::isVisible()
+{
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->isVisible();
+    });
+}
+
+void dullahan::setVisibleRegion(int x, int y, int width, int height)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->setVisibleRegion(x, y, width, height);
+    });
+}
+
+void dullahan::setFrameRate(int frame_rate)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->setFrameRate(frame_rate);
+    });
+}
+
+int dullahan::getFrameRate()
+{
+    return waitFor<int>(mImpl.get(), [&]()
+    {
+        return mImpl->getFrameRate();
+    });
+}
+
+void dullahan::setLifecycleState(ELifecycleState state)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->setLifecycleState(state);
+    });
+}
+
+dullahan::ELifecycleState dullahan::getLifecycleState()
+{
+    return waitFor<dullahan::ELifecycleState>(mImpl.get(), [&]()
+    {
+        return mImpl->getLifecycleState();
+    });
 }
 
 bool dullahan::editCanUndo()
 {
-	return mImpl->editCanUndo();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->editCanUndo();
+    });
 }
 
 bool dullahan::editCanRedo()
 {
-	return mImpl->editCanRedo();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->editCanRedo();
+    });
 }
 
 bool dullahan::editCanCopy()
 {
-    return mImpl->editCanCopy();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->editCanCopy();
+    });
 }
 
 bool dullahan::editCanCut()
 {
-    return mImpl->editCanCut();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->editCanCut();
+    });
 }
 
 bool dullahan::editCanPaste()
 {
-    return mImpl->editCanPaste();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->editCanPaste();
+    });
 }
 
 bool dullahan::editCanDelete()
 {
-	return mImpl->editCanDelete();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->editCanDelete();
+    });
 }
 
 bool dullahan::editCanSelectAll()
 {
-	return mImpl->editCanSelectAll();
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->editCanSelectAll();
+    });
 }
 
 void dullahan::editUndo()
 {
-	mImpl->editUndo();
+    mImpl->post([=, this]()
+    {
+        mImpl->editUndo();
+    });
 }
 
 void dullahan::editRedo()
 {
-	mImpl->editRedo();
+    mImpl->post([=, this]()
+    {
+        mImpl->editRedo();
+    });
 }
 
 void dullahan::editCopy()
 {
-    mImpl->editCopy();
+    mImpl->post([=, this]()
+    {
+        mImpl->editCopy();
+    });
 }
 
 void dullahan::editCut()
 {
-    mImpl->editCut();
+    mImpl->post([=, this]()
+    {
+        mImpl->editCut();
+    });
 }
 
 void dullahan::editPaste()
 {
-    mImpl->editPaste();
+    mImpl->post([=, this]()
+    {
+        mImpl->editPaste();
+    });
 }
 
 void dullahan::editDelete()
 {
-	mImpl->editDelete();
+    mImpl->post([=, this]()
+    {
+        mImpl->editDelete();
+    });
 }
 
 void dullahan::editSelectAll()
 {
-	mImpl->editSelectAll();
+    mImpl->post([=, this]()
+    {
+        mImpl->editSelectAll();
+    });
 }
 
 void dullahan::viewSource()
 {
-	mImpl->viewSource();
+    mImpl->post([=, this]()
+    {
+        mImpl->viewSource();
+    });
 }
 
 void dullahan::showDevTools()
 {
-    mImpl->showDevTools();
+    mImpl->post([=, this]()
+    {
+        mImpl->showDevTools();
+    });
 }
 
 void dullahan::closeDevTools()
 {
-    mImpl->closeDevTools();
+    mImpl->post([=, this]()
+    {
+        mImpl->closeDevTools();
+    });
 }
 
 void dullahan::printToPDF(const std::string path)
 {
-    mImpl->printToPDF(path);
+    mImpl->post([=, this]()
+    {
+        mImpl->printToPDF(path);
+    });
 }
 
 bool dullahan::setCookie(const std::string url, const std::string name,
@@ -317,26 +588,90 @@ void dullahan::deleteAllCookies()
     mImpl->deleteAllCookies();
 }
 
+void dullahan::setCookies(const std::vector<dullahan_cookie>& cookies,
+                          std::function<void(int num_set)> on_done)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->setCookies(cookies, on_done);
+    });
+}
+
+void dullahan::flushCookies(std::function<void()> on_done)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->flushCookies(on_done);
+    });
+}
+
+void dullahan::exportCookies(const std::string path, ECookieFileFormat format,
+                             std::function<void(bool ok, int num_cookies)> on_done)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->exportCookies(path, format, on_done);
+    });
+}
+
+void dullahan::importCookies(const std::string path,
+                             std::function<void(bool ok, int num_cookies)> on_done)
+{
+    mImpl->importCookies(path, on_done);
+}
+
+int dullahan::addCookieObserver(const std::string domain, const std::string name,
+                                std::function<void(const dullahan_cookie& cookie, ECookieChange change)> callback)
+{
+    return mImpl->addCookieObserver(domain, name, callback);
+}
+
+void dullahan::removeCookieObserver(int id)
+{
+    mImpl->removeCookieObserver(id);
+}
+
+void dullahan::getCookies(const std::string url_filter,
+                          std::function<void(const std::vector<dullahan_cookie>& cookies, bool last)> callback)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->getCookies(url_filter, callback);
+    });
+}
+
 void dullahan::postData(const std::string url,
                         const std::string data,
                         const std::string headers)
 {
-    mImpl->postData(url, data, headers);
+    mImpl->post([=, this]()
+    {
+        mImpl->postData(url, data, headers);
+    });
 }
 
 bool dullahan::executeJavaScript(const std::string cmd)
 {
-    return mImpl->executeJavaScript(cmd);
+    return waitFor<bool>(mImpl.get(), [&]()
+    {
+        return mImpl->executeJavaScript(cmd);
+    });
 }
 
 void dullahan::showBrowserMessage(const std::string msg)
 {
-    mImpl->showBrowserMessage(msg);
+    mImpl->post([=, this]()
+    {
+        mImpl->showBrowserMessage(msg);
+    });
 }
 
 void dullahan::setCustomSchemes(std::vector<std::string> custom_schemes)
 {
-    mImpl->setCustomSchemes(custom_schemes);
+    mImpl->post([=, this]()
+    {
+        mImpl->setCustomSchemes(custom_schemes);
+    });
 }
 
 std::vector<std::string>& dullahan::getCustomSchemes()
@@ -346,108 +681,288 @@ std::vector<std::string>& dullahan::getCustomSchemes()
 
 void dullahan::setOnAddressChangeCallback(std::function<void(const std::string url)> callback)
 {
-    mImpl->getCallbackManager()->setOnAddressChangeCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnAddressChangeCallback(callback);
+    });
 }
 
 void dullahan::setOnConsoleMessageCallback(std::function<void(const std::string message,
         const std::string source, int line)> callback)
 {
-    mImpl->getCallbackManager()->setOnConsoleMessageCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnConsoleMessageCallback(callback);
+    });
 }
 
 void dullahan::setOnCursorChangedCallback(std::function<void(const ECursorType type)> callback)
 {
-    mImpl->getCallbackManager()->setOnCursorChangedCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnCursorChangedCallback(callback);
+    });
 }
 
 void dullahan::setOnCustomSchemeURLCallback(std::function<void(const std::string url, 
                                             bool user_gesture, 
                                             bool is_redirect)> callback)
 {
-    mImpl->getCallbackManager()->setOnCustomSchemeURLCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnCustomSchemeURLCallback(callback);
+    });
 }
 
 void dullahan::setOnHTTPAuthCallback(std::function<bool(const std::string host,
                                      const std::string realm,
                                      std::string& username, std::string& password)> callback)
 {
-    mImpl->getCallbackManager()->setOnHTTPAuthCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnHTTPAuthCallback(callback);
+    });
 }
 
 void dullahan::setOnLoadEndCallback(std::function<void(int status, const std::string url)> callback)
 {
-    mImpl->getCallbackManager()->setOnLoadEndCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnLoadEndCallback(callback);
+    });
 }
 
 void dullahan::setOnLoadErrorCallback(std::function<void(int status, const std::string error_text, const std::string error_url)> callback)
 {
-    mImpl->getCallbackManager()->setOnLoadErrorCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnLoadErrorCallback(callback);
+    });
 }
 
 void dullahan::setOnLoadStartCallback(std::function<void()> callback)
 {
-    mImpl->getCallbackManager()->setOnLoadStartCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnLoadStartCallback(callback);
+    });
 }
 
 void dullahan::setOnOpenPopupCallback(std::function<void(const std::string url,
                                       const std::string target)> callback)
 {
-    mImpl->getCallbackManager()->setOnOpenPopupCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnOpenPopupCallback(callback);
+    });
 }
 
 void dullahan::setOnPageChangedCallback(std::function<void(const unsigned char* pixels,
                                         int x, int y,
                                         int width, int height)> callback)
 {
-    mImpl->getCallbackManager()->setOnPageChangedCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnPageChangedCallback(callback);
+    });
+}
+
+void dullahan::setOnPageChangedRegionsCallback(std::function<void(const unsigned char* pixels,
+                                               int width, int height,
+                                               const std::vector<dullahan_rect>& dirty_rects)> callback)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnPageChangedRegionsCallback(callback);
+    });
+}
+
+void dullahan::setOnPixelBufferResizeCallback(std::function<void(int width, int height)> callback)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnPixelBufferResizeCallback(callback);
+    });
 }
 
 void dullahan::setOnRequestExitCallback(std::function<void()> callback)
 {
-    mImpl->getCallbackManager()->setOnRequestExitCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnRequestExitCallback(callback);
+    });
+}
+
+void dullahan::setOnReadyCallback(std::function<void(bool ok)> callback)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnReadyCallback(callback);
+    });
 }
 
 void dullahan::setOnStatusMessageCallback(std::function<void(const std::string message)> callback)
 {
-    mImpl->getCallbackManager()->setOnStatusMessageCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnStatusMessageCallback(callback);
+    });
 }
 
 void dullahan::setOnTitleChangeCallback(std::function<void(const std::string title)> callback)
 {
-    mImpl->getCallbackManager()->setOnTitleChangeCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnTitleChangeCallback(callback);
+    });
 }
 
 void dullahan::setOnTooltipCallback(std::function<void(const std::string text)> callback)
 {
-    mImpl->getCallbackManager()->setOnTooltipCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnTooltipCallback(callback);
+    });
 }
 
 void dullahan::setOnPdfPrintFinishedCallback(std::function<void(const std::string path, bool ok)> callback)
 {
-    mImpl->getCallbackManager()->setOnPdfPrintFinishedCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnPdfPrintFinishedCallback(callback);
+    });
 }
 
 void dullahan::setOnFileDownloadProgressCallback(std::function<void(int percent, bool complete)> callback)
 {
-    mImpl->getCallbackManager()->setOnFileDownloadProgressCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnFileDownloadProgressCallback(callback);
+    });
 }
 
 void dullahan::setOnFileDialogCallback(std::function<const std::vector<std::string>(dullahan::EFileDialogType dialog_type, const std::string dialog_title, const std::string default_file, const std::string dialog_accept_filter, bool& use_default)> callback)
 {
-    mImpl->getCallbackManager()->setOnFileDialogCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnFileDialogCallback(callback);
+    });
 }
 
 void dullahan::setOnJSDialogCallback(std::function<bool(const std::string origin_url, const std::string message_text, const std::string default_prompt_text)> callback)
 {
-    mImpl->getCallbackManager()->setOnJSDialogCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnJSDialogCallback(callback);
+    });
 }
 
 void dullahan::setOnJSBeforeUnloadCallback(std::function<bool()> callback)
 {
-    mImpl->getCallbackManager()->setOnJSBeforeUnloadCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnJSBeforeUnloadCallback(callback);
+    });
 }
 
 void dullahan::setOnJStoCPPMsgCallback(std::function<std::string(const std::string id, const std::string msg)> callback)
 {
-    mImpl->getCallbackManager()->setOnJStoCPPMsgCallback(callback);
+    mImpl->post([=, this]()
+    {
+        mImpl->getCallbackManager()->setOnJStoCPPMsgCallback(callback);
+    });
+}
+
+dullahan_engine::dullahan_engine() :
+    mImpl(new dullahan_engine_impl())
+{
+    DLNOUT("dullahan_engine::dullahan_engine()");
+    mImpl->AddRef();
+}
+
+dullahan_engine::~dullahan_engine()
+{
+    DLNOUT("dullahan_engine::~dullahan_engine()");
+    mImpl->Release();
+}
+
+bool dullahan_engine::init(dullahan::dullahan_settings& user_settings)
+{
+    return mImpl->init(user_settings);
+}
+
+bool dullahan_engine::initAsync(dullahan::dullahan_settings& user_settings)
+{
+    return mImpl->initAsync(user_settings);
+}
+
+bool dullahan_engine::isReady()
+{
+    return mImpl->isReady();
+}
+
+void dullahan_engine::shutdown()
+{
+    mImpl->shutdown();
+}
+
+void dullahan_engine::run()
+{
+    mImpl->run();
+}
+
+void dullahan_engine::update()
+{
+    mImpl->update();
+}
+
+dullahan::dullahan_update_result dullahan_engine::update(int64_t budget_us)
+{
+    return mImpl->update(budget_us);
+}
+
+void dullahan_engine::getUpdateStats(dullahan::dullahan_update_stats& stats)
+{
+    mImpl->getUpdateStats(stats);
+}
+
+void dullahan_engine::resetUpdateStats()
+{
+    mImpl->resetUpdateStats();
+}
+
+int dullahan_engine::getUpdateDelay()
+{
+    return mImpl->getUpdateDelay();
+}
+
+int dullahan_engine::getUpdateFd()
+{
+    return mImpl->getUpdateFd();
+}
+
+void dullahan_engine::getShutdownStats(dullahan::dullahan_shutdown_stats& stats)
+{
+    mImpl->getShutdownStats(stats);
+}
+
+int dullahan_engine::getBrowserCount()
+{
+    return mImpl->getBrowserCount();
+}
+
+void dullahan_engine::setBrowserPoolSize(int size)
+{
+    mImpl->post([=, this]()
+    {
+        mImpl->setBrowserPoolSize(size);
+    });
+}
+
+void dullahan_engine::getBrowserPoolStats(int& hits, int& misses, int& ready)
+{
+    mImpl->wait([&]()
+    {
+        mImpl->getBrowserPoolStats(hits, misses, ready);
+    });
 }
@@ -34,6 +34,8 @@
 #include <cstdint>
 
 class dullahan_impl;
+class dullahan_engine;
+class dullahan_engine_impl;
 
 class dullahan
 {
@@ -130,6 +132,121 @@ class dullahan
             FD_SAVE_FILE,
         } EFileDialogType;
 
+        ////////// pixel formats for page output //////////
+        typedef enum e_pixel_format
+        {
+            PF_BGRA,            // B, G, R, A bytes with premultiplied alpha - what CEF produces
+            PF_RGBA,            // R, G, B, A bytes with premultiplied alpha
+            PF_BGRA_STRAIGHT,   // B, G, R, A bytes with straight (non-premultiplied) alpha
+            PF_RGBA_STRAIGHT,   // R, G, B, A bytes with straight (non-premultiplied) alpha
+            PF_XRGB,            // B, G, R, 0xff bytes - opaque XRGB as a little endian 32 bit word
+            PF_RGB24,           // R, G, B bytes - 3 bytes per pixel, no alpha
+        } EPixelFormat;
+
+        ////////// how much of the browser is kept running //////////
+        typedef enum e_lifecycle_state
+        {
+            LS_ACTIVE,          // running at the full frame rate
+            LS_THROTTLED,       // running at throttled_frame_rate
+            LS_FROZEN,          // JavaScript timers and rendering suspended - page stays in memory
+            LS_DISCARDED,       // browser closed - only a snapshot of the last frame and the URL are kept
+        } ELifecycleState;
+
+        ////////// formats exportCookies(..) can write //////////
+        typedef enum e_cookie_file_format
+        {
+            CF_BINARY,          // our own compact format - quickest to write and read back
+            CF_NETSCAPE,        // cookies.txt as used by curl, wget and friends
+        } ECookieFileFormat;
+
+        ////////// what happened to a cookie a cookie observer hears about //////////
+        typedef enum e_cookie_change
+        {
+            CC_SET,             // set or changed
+            CC_DELETED,         // deleted or expired - an empty domain and name means every cookie
+        } ECookieChange;
+
+        ////////// where a browser keeps its cache and cookies //////////
+        typedef enum e_request_context_policy
+        {
+            RCP_PERSISTENT,     // the engine's, on disk under root_cache_path and shared with its other browsers
+            RCP_EPHEMERAL,      // its own, held in memory and thrown away once the browser closes
+        } ERequestContextPolicy;
+
+        ////////// region of the page (in pixel buffer coordinates) //////////
+        struct dullahan_rect
+        {
+            int x = 0;
+            int y = 0;
+            int width = 0;
+            int height = 0;
+        };
+
+        ////////// consumer owned memory that page pixels are written into //////////
+        struct dullahan_pixel_buffer
+        {
+            unsigned char* pixels = nullptr;
+            int width = 0;                  // must be at least as big as the page
+            int height = 0;
+            int row_pitch = 0;              // bytes from the start of one row to the next
+            EPixelFormat format = PF_BGRA;
+        };
+
+        ////////// a finished frame handed over to another thread //////////
+        struct dullahan_frame
+        {
+            const unsigned char* pixels = nullptr;
+            int width = 0;
+            int height = 0;
+            int row_pitch = 0;
+            EPixelFormat format = PF_BGRA;
+            uint64_t sequence = 0;                      // goes up by one for every frame painted
+            std::vector<dullahan_rect> dirty_rects;     // changed since the last frame you acquired
+        };
+
+        ////////// what a call to update(budget_us) did //////////
+        struct dullahan_update_result
+        {
+            int64_t time_us = 0;                        // time spent in the call
+            int slices = 0;                             // number of times CEF was given a turn
+            bool work_remaining = false;                // CEF still had work due when we stopped
+        };
+
+        ////////// running totals for update() calls //////////
+        struct dullahan_update_stats
+        {
+            uint64_t updates = 0;                       // calls to update()
+            uint64_t slices = 0;                        // times CEF was given a turn
+            uint64_t over_budget = 0;                   // calls that took longer than their budget
+            int64_t total_time_us = 0;
+            int64_t max_time_us = 0;                    // longest single call
+            int64_t max_slice_us = 0;                   // longest single turn CEF had
+        };
+
+        ////////// how long each part of shutting down took //////////
+        struct dullahan_shutdown_stats
+        {
+            int64_t cookie_flush_us = 0;                // requestExit() until cookies were written
+            int64_t browser_close_us = 0;               // requestExit() until the browser closed
+            int64_t exit_us = 0;                        // requestExit() until onRequestExit
+            bool timed_out = false;                     // exit_timeout_ms went by first
+            int64_t pool_close_us = 0;                  // engine closing its pooled browsers
+            int64_t cef_shutdown_us = 0;                // engine shutting CEF down
+        };
+
+        ////////// a cookie to set (or one read back from the cookie store) //////////
+        struct dullahan_cookie
+        {
+            std::string url;                            // where it is set from - domain and path default to it (empty when read back)
+            std::string name;
+            std::string value;
+            std::string domain;
+            std::string path;
+            int64_t expires = 0;                        // seconds since 1970 (UTC) - 0 for a session cookie
+            bool httponly = false;
+            bool secure = false;
+        };
+
     public:
         //////////// initialization settings ////////////
         struct dullahan_settings
@@ -151,6 +268,52 @@ class dullahan
             // default frame rate
             int frame_rate = 60;
 
+            // drop to idle_frame_rate once the page has gone idle_paint_count paints (or the
+            // same number of frame intervals) without changing more than a sliver of the page.
+            // Input, navigation or a big change puts it straight back to the full frame rate
+            bool adaptive_frame_rate = false;
+            int idle_frame_rate = 5;
+            int idle_paint_count = 30;
+
+            // maximum frame rate while in the LS_THROTTLED lifecycle state
+            int throttled_frame_rate = 10;
+
+            // number of hidden about:blank browsers a dullahan_engine keeps started up so
+            // new instances don't have to wait for one (and its renderer) - 0 for none
+            int browser_pool_size = 0;
+
+            // RCP_EPHEMERAL keeps this browser's cache and cookies to itself and purely in
+            // memory - no disk IO for ads, previews or one-shot pages. Cookie calls on it
+            // only see its own cookies, and it never gets a browser from the pool
+            ERequestContextPolicy request_context_policy = RCP_PERSISTENT;
+
+            // largest HTTP cache in megabytes - held in memory for RCP_EPHEMERAL browsers and
+            // on disk for the rest. Chromium picks if 0. Set for the whole engine when it starts
+            int cache_size_mb = 0;
+
+            // longest requestExit() waits for the page to close and cookies to be written
+            // before onRequestExit is called anyway (the page is then closed by force)
+            int exit_timeout_ms = 2000;
+
+            // cookies set with setCookie(..) or setCookies(..) are written to disk this long
+            // after the first one that hasn't been - so a burst of them costs one write.
+            // 0 writes after every call. flushCookies() writes straight away
+            int cookie_flush_delay_ms = 1000;
+
+            // let CEF run its UI thread itself instead of doing its work in update() (Windows
+            // and Linux only - ignored on macOS). Every method can then be called from any
+            // thread: calls are queued for CEF's thread and the ones that return something wait
+            // for it. Call init(), shutdown() and dullahan_engine::shutdown() from the thread
+            // you call update() on, and never from a callback made on CEF's thread
+            bool multi_threaded_message_loop = false;
+
+            // with multi_threaded_message_loop, hold callbacks back until update() so they are
+            // made on your thread instead of CEF's. Callbacks that must return an answer to CEF
+            // (and onPixelBufferResize) are still made on CEF's thread. Page changed callbacks
+            // are made from the newest frame in the frame exchange with regions covering every
+            // paint since the last one, so don't call acquireLatestFrame(..) yourself as well
+            bool callbacks_on_update_thread = true;
+
             // enable/disable features - most obvious but listed for completeness
             bool begin_frame_scheduling = false;        // fixes issue when onPaint not called
             bool cookies_enabled = true;                // cookies
@@ -177,6 +340,17 @@ class dullahan
             // are derrived from - must be an absolute, unique path for each instance
             std::string root_cache_path = std::string();
 
+            // leave root_cache_path empty and set this instead to have the engine lease one of
+            // the profiles kept in this directory - the most recently used one nobody else has
+            // (so its cache is still warm) or a new one. root_cache_path says which once init()
+            // returns and it is given back by dullahan_engine::shutdown() - init() fails if none
+            // can be had. Unused profiles are thrown away in the background to keep within the
+            // limits below (0 for no limit)
+            std::string profile_pool_path = std::string();
+            int profile_pool_max_profiles = 4;
+            int profile_pool_max_size_mb = 0;           // all the profiles together
+            int profile_pool_max_unused_days = 30;
+
             // list of language locale codes used to configure the Accept-Language HTTP header value
             // and change the default language of the browser
             std::string accept_language_list = "en-us";
@@ -190,6 +364,24 @@ class dullahan
             // flip pixel buffer in Y direction
             bool flip_pixels_y = false;
 
+            // layout of the pixels passed to the page changed callbacks - converted from CEF's
+            // BGRA during the copy we make anyway. Use getDepth() for the bytes per pixel
+            EPixelFormat output_pixel_format = PF_BGRA;
+
+            // pass the CEF paint buffer directly to the page changed callbacks instead of copying
+            // it first when possible (no flip, no popup open) - pixels are only valid for the
+            // duration of the callback so consumers must copy or upload them before returning.
+            // Only applies when output_pixel_format is PF_BGRA
+            bool zero_copy_frames = false;
+
+            // hash the page in tiles after each paint and skip the page changed callbacks when
+            // no pixels actually changed - regions passed to consumers are then whole tiles
+            bool suppress_unchanged_frames = false;
+
+            // keep three copies of the page so a thread other than the one running CEF can
+            // pick up finished frames with acquireLatestFrame(..) without ever blocking it
+            bool threaded_frame_exchange = false;
+
             // flip mouse input in Y direction
             bool flip_mouse_y = false;
 
@@ -214,18 +406,58 @@ class dullahan
         // initialize everything - call before anything else
         bool init(dullahan_settings& user_settings);
 
+        // create this browser in an engine shared with other dullahan instances instead
+        // of starting CEF for it. Only the settings for the browser itself (size, frame
+        // rates, pixel layout, javascript, webgl etc.) are used - the process wide ones
+        // (paths, cookies, proxy, command line switches) come from dullahan_engine::init(..)
+        bool init(dullahan_engine& engine, dullahan_settings& user_settings);
+
+        // same as init(..) but returns as soon as CEF has started instead of waiting for it
+        // to get ready and create the browser - keep calling update() and the ready callback
+        // says when that has happened. Calls that don't return anything made in the meantime
+        // are held and made in order once the browser exists. The ones that do return
+        // something answer straight away from what is known before then
+        bool initAsync(dullahan_settings& user_settings);
+        bool initAsync(dullahan_engine& engine, dullahan_settings& user_settings);
+
         // close down CEF - call just before you exit
+        // (for a browser in a shared engine, this only lets go of the browser)
         void shutdown();
 
         // indicate to CEF you want to exit - after you call this,
         // wait for onRequestExit() callback before calling shutdown()
         void requestExit();
 
-        // accessors for size of virtual window
+        // how long the last requestExit() and shutdown() took, a phase at a time - the
+        // engine phases are only filled in for a browser that had an engine of its own
+        void getShutdownStats(dullahan_shutdown_stats& stats);
+
+        // accessors for size of virtual window - depth is bytes per pixel of the output format
         void getSize(int& width, int& height);
         void setSize(int width, int height);
         int getDepth();
 
+        // write page pixels straight into memory you own (e.g. a mapped shared memory segment)
+        // instead of dullahan's own buffer - page changed callbacks then point into it. Call
+        // after init(). Pass a buffer with pixels set to nullptr to go back to the internal one
+        void setPixelBuffer(const dullahan_pixel_buffer& buffer);
+
+        // when threaded_frame_exchange is set, fetch the newest painted frame if there is one
+        // you haven't seen yet - returns false if not. Call from one thread only (any thread)
+        // and the pixels remain valid until you call it again
+        bool acquireLatestFrame(dullahan_frame& frame);
+
+        // pull the page as it is now along with the regions that changed since the frame
+        // numbered last_sequence (pass 0 to treat everything as changed). Returns false if
+        // nothing was painted since. Call from the thread you call update() on - pixels are
+        // valid until the next update(). Not available while zero_copy_frames is handing out
+        // CEF's own buffer since we don't have a copy of the page then
+        bool acquireFrame(uint64_t last_sequence, dullahan_frame& frame);
+
+        // bytes dullahan is holding on to for page pixels (its own page buffer, popups and
+        // the frame exchange) - call from the thread you call update() on
+        size_t getPixelMemoryFootprint();
+
         // run CEF in it's own message loop - doesn't exit until requestExit()
         // and shutdown() calls triggered
         // Note: complimentary to update();
@@ -233,8 +465,28 @@ class dullahan
 
         // do some work in CEF - call regularly in your own message loop
         // Note: complimentary to run();
+        // (for a browser in a shared engine, call dullahan_engine::update() instead)
         void update();
 
+        // same as update() but keeps giving CEF turns while it has work due until budget_us
+        // microseconds have gone by. CEF can't be interrupted during a turn so a slow one can
+        // still take the call over budget. A budget of 0 gives CEF exactly one turn
+        // (with multi_threaded_message_loop CEF gets no turns here - update() just makes the
+        // callbacks held for your thread so call it from one thread only)
+        dullahan_update_result update(int64_t budget_us);
+
+        // timings for every update() call so far - reset clears them
+        void getUpdateStats(dullahan_update_stats& stats);
+        void resetUpdateStats();
+
+        // milliseconds until update() needs calling again - CEF says when it has work to
+        // do so there is no need to call it every frame if you can sleep until then
+        int getUpdateDelay();
+
+        // Linux only: a timerfd that becomes readable when update() needs calling, for
+        // waiting in poll()/select() along with your own file descriptors. -1 elsewhere
+        int getUpdateFd();
+
         // transport control
         bool canGoBack();
         void goBack();
@@ -281,6 +533,26 @@ class dullahan
         // set the page zoom
         void setPageZoom(const double zoom_val);
 
+        // tell dullahan whether anyone can see the page. Hidden pages stop rendering and
+        // copying pixels but the last frame stays in the pixel buffer for you to display
+        void setVisible(bool visible);
+        bool isVisible();
+
+        // hint that only part of the page (in pixel buffer coordinates) is visible - e.g. the
+        // surface is partly off screen or covered. Pixels outside it are not copied until it
+        // grows again. Pass a width or height of 0 to go back to the whole page
+        void setVisibleRegion(int x, int y, int width, int height);
+
+        // change the maximum rate the page is painted at (1 - 60) after init()
+        void setFrameRate(int frame_rate);
+        int getFrameRate();
+
+        // move the browser between lifecycle states to bound how much CPU and memory it uses
+        // when there are lots of them. A discarded browser is recreated on the same URL when
+        // it becomes active again and its snapshot is passed on as a frame until the page paints
+        void setLifecycleState(ELifecycleState state);
+        ELifecycleState getLifecycleState();
+
         // indicates if there is something available to be copy/cut/pasted
         // (for UI purposes) and if so, provides methods to do so
         bool editCanUndo();
@@ -307,7 +579,9 @@ class dullahan
         // print page to PDF
         void printToPDF(const std::string path);
 
-        // cookies
+        // cookies - these talk to CEF's cookie store directly so they are never queued.
+        // setCookie(..) waits for the cookie to be set but not for it to be written to disk
+        // and getCookies() waits (a couple of seconds at most) for the names of them all
         bool setCookie(const std::string url,
                        const std::string name, const std::string value,
                        const std::string domain, const std::string path,
@@ -315,6 +589,38 @@ class dullahan
         const std::vector<std::string> getCookies();
         void deleteAllCookies();
 
+        // set a batch of cookies without waiting - on_done is called (like any other
+        // callback) with how many were set once CEF has tried them all. Writing them to
+        // disk is left to cookie_flush_delay_ms or flushCookies(..), whose on_done is
+        // called once the cookie store has been written
+        void setCookies(const std::vector<dullahan_cookie>& cookies,
+                        std::function<void(int num_set)> on_done = nullptr);
+        void flushCookies(std::function<void()> on_done = nullptr);
+
+        // read cookies back without waiting - every one, or just those that would be sent
+        // to url_filter. They come in batches and last is set on the final call (which may
+        // be empty). The cookie store is only read, never written
+        void getCookies(const std::string url_filter,
+                        std::function<void(const std::vector<dullahan_cookie>& cookies, bool last)> callback);
+
+        // save every cookie to a file or set every cookie in one (in either format, which
+        // is worked out from the file). Neither waits - on_done says if it worked and how
+        // many cookies there were. Imports are set as one batch and written to disk once
+        void exportCookies(const std::string path, ECookieFileFormat format = CF_BINARY,
+                           std::function<void(bool ok, int num_cookies)> on_done = nullptr);
+        void importCookies(const std::string path,
+                           std::function<void(bool ok, int num_cookies)> on_done = nullptr);
+
+        // be told when cookies change instead of polling for them - cookies pages set with
+        // Set-Cookie headers and the ones set, imported or deleted through this API (not
+        // ones JavaScript sets). domain and name pick which ("" for any - a domain covers
+        // its subdomains too). Changes are gathered up and delivered once per update() with
+        // one call per cookie giving its latest state. Returns an id for removing it again
+        // (0 if there was no callback)
+        int addCookieObserver(const std::string domain, const std::string name,
+                              std::function<void(const dullahan_cookie& cookie, ECookieChange change)> callback);
+        void removeCookieObserver(int id);
+
         // POST data to a URL
         void postData(const std::string url,
                       const std::string data,
@@ -369,9 +675,23 @@ class dullahan
                                       int x, int y,
                                       int width, int height)> callback);
 
+        // contents of the page changes - pixels is the whole page but only the (merged) regions
+        // listed in dirty_rects have changed since the last call. Regions are expressed in pixel
+        // buffer coordinates so they are already flipped if flip_pixels_y is set
+        void setOnPageChangedRegionsCallback(std::function<void(const unsigned char* pixels,
+                                             int width, int height,
+                                             const std::vector<dullahan_rect>& dirty_rects)> callback);
+
+        // page no longer fits in the buffer passed to setPixelBuffer(..) - call setPixelBuffer(..)
+        // from the callback with one that does or dullahan goes back to using its own buffer
+        void setOnPixelBufferResizeCallback(std::function<void(int width, int height)> callback);
+
         // exit app requested
         void setOnRequestExitCallback(std::function<void()> callback);
 
+        // browser created after initAsync(..) (or init(..)) - ok is false if it couldn't be
+        void setOnReadyCallback(std::function<void(bool ok)> callback);
+
         // browser status message changes
         void setOnStatusMessageCallback(std::function<void(const std::string message)> callback);
 
@@ -404,4 +724,59 @@ class dullahan
         std::unique_ptr <dullahan_impl> mImpl;
 };
 
+// One CEF instance shared by any number of dullahan browsers - it owns CEF itself,
+// the message loop and the request context so each extra browser costs a renderer
+// rather than a whole browser process and CEF start up of its own
+class dullahan_engine
+{
+    public:
+        dullahan_engine();
+        ~dullahan_engine();
+
+        // start CEF using the process wide parts of the settings - call before
+        // passing the engine to dullahan::init(..)
+        bool init(dullahan::dullahan_settings& user_settings);
+
+        // same but returns once CEF has started - browsers given to dullahan::initAsync(..)
+        // are created when it is ready (as update() runs) and isReady() says if it is yet
+        bool initAsync(dullahan::dullahan_settings& user_settings);
+        bool isReady();
+
+        // close down CEF - shutdown() every browser in the engine first
+        void shutdown();
+
+        // same as dullahan::run() and dullahan::update() but for every browser in the engine
+        void run();
+        void update();
+
+        // same as dullahan::getUpdateDelay() and dullahan::getUpdateFd()
+        int getUpdateDelay();
+        int getUpdateFd();
+
+        // same as dullahan::update(budget_us), getUpdateStats(..) and resetUpdateStats()
+        dullahan::dullahan_update_result update(int64_t budget_us);
+        void getUpdateStats(dullahan::dullahan_update_stats& stats);
+        void resetUpdateStats();
+
+        // the engine phases of dullahan::getShutdownStats(..) - after shutdown()
+        void getShutdownStats(dullahan::dullahan_shutdown_stats& stats);
+
+        // number of browsers currently in the engine
+        int getBrowserCount();
+
+        // change how many browsers are kept ready for new instances - the pool is
+        // topped up a browser at a time from update() so it never holds it up for long
+        void setBrowserPoolSize(int size);
+
+        // how often a new instance got a browser from the pool (hits) or had to wait
+        // for one to be created (misses) and how many are ready to go right now
+        void getBrowserPoolStats(int& hits, int& misses, int& ready);
+
+    private:
+        friend class dullahan;
+
+        // reference counted since CEF holds on to it too
+        dullahan_engine_impl* mImpl;
+};
+
 #endif //  _DULLAHAN
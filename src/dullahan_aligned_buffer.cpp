@@ -0,0 +1,101 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "dullahan_aligned_buffer.h"
+
+#include <new>
+
+namespace
+{
+    // keeps rows handed to the SIMD kernels from straddling cache lines
+    const size_t BUFFER_ALIGNMENT = 64;
+
+    // growing reserves this fraction again so the next few steps of a resize fit
+    const size_t GROWTH_HEADROOM_DIVISOR = 4;
+
+    // shrinking only reallocates once less than this fraction is in use
+    const size_t SHRINK_THRESHOLD_DIVISOR = 4;
+}
+
+dullahan_aligned_buffer::dullahan_aligned_buffer() :
+    mData(nullptr),
+    mSize(0),
+    mCapacity(0)
+{
+}
+
+dullahan_aligned_buffer::~dullahan_aligned_buffer()
+{
+    release();
+}
+
+bool dullahan_aligned_buffer::resize(size_t bytes)
+{
+    mSize = bytes;
+
+    const bool too_small = bytes > mCapacity;
+    const bool too_big = bytes < mCapacity / SHRINK_THRESHOLD_DIVISOR;
+    if (mData != nullptr && !too_small && !too_big)
+    {
+        return false;
+    }
+
+    size_t capacity = bytes + bytes / GROWTH_HEADROOM_DIVISOR;
+    capacity = (capacity + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1);
+
+    release();
+    mData = static_cast<unsigned char*>(::operator new[](capacity, std::align_val_t(BUFFER_ALIGNMENT)));
+    mCapacity = capacity;
+    mSize = bytes;
+
+    return true;
+}
+
+void dullahan_aligned_buffer::release()
+{
+    if (mData != nullptr)
+    {
+        ::operator delete[](mData, std::align_val_t(BUFFER_ALIGNMENT));
+        mData = nullptr;
+    }
+    mSize = 0;
+    mCapacity = 0;
+}
+
+unsigned char* dullahan_aligned_buffer::data() const
+{
+    return mData;
+}
+
+size_t dullahan_aligned_buffer::size() const
+{
+    return mSize;
+}
+
+size_t dullahan_aligned_buffer::capacity() const
+{
+    return mCapacity;
+}
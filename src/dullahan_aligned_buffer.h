@@ -0,0 +1,65 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef _DULLAHAN_ALIGNED_BUFFER
+#define _DULLAHAN_ALIGNED_BUFFER
+
+#include <cstddef>
+
+// A block of cache line aligned memory for pixels that hangs on to its capacity
+// as it is resized. Growing reserves some headroom and shrinking only hands memory
+// back once most of it is going unused, so a view being dragged bigger and smaller
+// doesn't hit the allocator on every step. Memory is never cleared here - callers
+// overwrite or clear just the parts they need.
+class dullahan_aligned_buffer
+{
+    public:
+        dullahan_aligned_buffer();
+        ~dullahan_aligned_buffer();
+
+        // make room for bytes, keeping the current allocation if it fits and isn't
+        // much too big. Returns true if it had to reallocate - contents are lost then
+        bool resize(size_t bytes);
+
+        // give the memory back
+        void release();
+
+        unsigned char* data() const;
+
+        // bytes asked for in the last resize(..) and bytes actually held
+        size_t size() const;
+        size_t capacity() const;
+
+    private:
+        dullahan_aligned_buffer(const dullahan_aligned_buffer&) = delete;
+        dullahan_aligned_buffer& operator=(const dullahan_aligned_buffer&) = delete;
+
+        unsigned char* mData;
+        size_t mSize;
+        size_t mCapacity;
+};
+
+#endif // _DULLAHAN_ALIGNED_BUFFER
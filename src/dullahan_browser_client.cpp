@@ -36,13 +36,12 @@
 #include "dullahan_impl.h"
 
 #include <algorithm>
-#include <chrono>
 #include <iostream>
-#include <thread>
 
 dullahan_browser_client::dullahan_browser_client(dullahan_impl* parent,
     scoped_refptr<dullahan_render_handler> render_handler) :
     mParent(parent),
+    mIOParent(parent),
     mRenderHandler(render_handler)
 {
     DLNOUT("dullahan_browser_client::dullahan_browser_client - parent ptr = " << parent);
@@ -59,6 +58,38 @@ CefRefPtr<CefRenderHandler> dullahan_browser_client::GetRenderHandler()
     return mRenderHandler;
 }
 
+void dullahan_browser_client::setParent(dullahan_impl* parent, CefRefPtr<dullahan_render_handler> render_handler)
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    DLNOUT("dullahan_browser_client::setParent - parent ptr = " << parent);
+
+    // CEF asks us for the render handler each time it needs it so this takes effect straight away
+    mParent = parent;
+    mRenderHandler = render_handler;
+
+    std::lock_guard<std::mutex> lock(mIOParentMutex);
+    mIOParent = parent;
+}
+
+void dullahan_browser_client::detachParent()
+{
+    mParent = nullptr;
+
+    std::lock_guard<std::mutex> lock(mIOParentMutex);
+    mIOParent = nullptr;
+}
+
+CefRefPtr<CefBrowser> dullahan_browser_client::getBrowser()
+{
+    if (mBrowserList.empty())
+    {
+        return nullptr;
+    }
+
+    return mBrowserList.front();
+}
+
 // CefClient override
 bool dullahan_browser_client::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser,
         CefRefPtr<CefFrame> frame,
@@ -67,6 +98,11 @@ bool dullahan_browser_client::OnProcessMessageReceived(CefRefPtr<CefBrowser> bro
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return false;
+    }
+
     if (message->GetName() == "JSONtoCPP_MSG")
     {
         CefRefPtr<CefListValue> args = message->GetArgumentList();
@@ -144,21 +180,13 @@ void dullahan_browser_client::OnBeforeClose(CefRefPtr<CefBrowser> browser)
         }
     }
 
-    if (mBrowserList.empty())
+    // a browser discarded to save resources isn't the last one going away before exit and
+    // once we've been detached nothing closing here is the instance's browser any more.
+    // CEF finishing its own work (writing cookies etc.) is waited for separately - see
+    // dullahan_impl::requestExit() - rather than by pumping it here for a fixed time
+    if (mBrowserList.empty() && mParent && !mParent->browserWasDiscarded())
     {
-        // necessary to enforce CEF finishes work before exit - writing cookies file for example.
-        // see: https://github.com/chromiumembedded/cef/blob/2773518869b5f57a848e807ddb2ee30adbf1c255/tests/shared/browser/main_message_loop_external_pump_win.cc#L91
-        // and: https://bitbucket.org/chromiumembedded/cef/issues/1805/
-        const int num_extra_cef_work_loops = 10;
-        const int sleep_time_between_calls = 50;
-
-        for (int i = 0; i < num_extra_cef_work_loops; ++i)
-        {
-            CefDoMessageLoopWork();
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time_between_calls));
-        }
-
-        mParent->getCallbackManager()->onRequestExit();
+        mParent->onBrowserClosed();
     }
 }
 
@@ -176,6 +204,11 @@ void dullahan_browser_client::OnAddressChange(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     mParent->getCallbackManager()->onAddressChange(std::string(url));
 }
 
@@ -186,6 +219,11 @@ bool dullahan_browser_client::OnConsoleMessage(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return true;
+    }
+
     mParent->getCallbackManager()->onConsoleMessage(std::string(message),
             std::string(source), line);
 
@@ -198,6 +236,11 @@ void dullahan_browser_client::OnStatusMessage(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     mParent->getCallbackManager()->onStatusMessage(std::string(value));
 }
 
@@ -207,6 +250,11 @@ void dullahan_browser_client::OnTitleChange(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     mParent->getCallbackManager()->onTitleChange(std::string(title));
 }
 
@@ -216,6 +264,11 @@ bool dullahan_browser_client::OnTooltip(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return false;
+    }
+
     mParent->getCallbackManager()->OnTooltip(std::string(text));
     return false;
 }
@@ -227,6 +280,11 @@ bool dullahan_browser_client::OnCursorChange(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return false;
+    }
+
     mParent->getCallbackManager()->onCursorChanged((dullahan::ECursorType)type);
 
     return false;
@@ -238,6 +296,11 @@ void dullahan_browser_client::OnLoadingStateChange(CefRefPtr<CefBrowser> browser
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     // Terrible hack but AFAICT, this is the only (and perhaps even official) way to
     // establish a zoom across the browser - there ought to be a setting at startup to change this.
     // Each time a page load starts/ends, this will re-request the zoom. The page zoom is reset
@@ -252,8 +315,16 @@ void dullahan_browser_client::OnLoadStart(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     if (frame->IsMain())
     {
+        // new page is coming so paint it at the full rate
+        mParent->wakeFrameRate();
+
         mParent->getCallbackManager()->onLoadStart();
     }
 }
@@ -264,6 +335,11 @@ void dullahan_browser_client::OnLoadEnd(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     if (frame->IsMain())
     {
         const std::string url = frame->GetURL();
@@ -279,6 +355,11 @@ void dullahan_browser_client::OnLoadError(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     if (errorCode == ERR_ABORTED)
     {
         return;
@@ -297,6 +378,11 @@ bool dullahan_browser_client::OnBeforeBrowse(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return false;
+    }
+
     std::string url = request->GetURL();
 
     // for comparison, use lowercase
@@ -335,6 +421,15 @@ bool dullahan_browser_client::GetAuthCredentials(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_IO_THREAD();
 
+    {
+        std::lock_guard<std::mutex> lock(mIOParentMutex);
+        if (!mIOParent)
+        {
+            callback->Cancel();
+            return false;
+        }
+    }
+
     std::string host_str = host;
     std::string realm_str = realm;
     std::string scheme_str = scheme;
@@ -355,6 +450,40 @@ bool dullahan_browser_client::GetAuthCredentials(CefRefPtr<CefBrowser> browser,
     }
 }
 
+// Watching every request costs a little so we only do it when somebody
+// wants to hear about cookies the pages set - see CanSaveCookie(..)
+CefRefPtr<CefResourceRequestHandler> dullahan_browser_client::GetResourceRequestHandler(CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame, CefRefPtr<CefRequest> request,
+        bool is_navigation, bool is_download, const CefString& request_initiator,
+        bool& disable_default_handling)
+{
+    CEF_REQUIRE_IO_THREAD();
+
+    std::lock_guard<std::mutex> lock(mIOParentMutex);
+    if (mIOParent && mIOParent->hasCookieObservers())
+    {
+        return this;
+    }
+
+    return nullptr;
+}
+
+// a Set-Cookie header in a response - the cookie is always saved, we just take note
+bool dullahan_browser_client::CanSaveCookie(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+        CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response,
+        const CefCookie& cookie)
+{
+    CEF_REQUIRE_IO_THREAD();
+
+    std::lock_guard<std::mutex> lock(mIOParentMutex);
+    if (mIOParent)
+    {
+        mIOParent->onCookieSaved(cookie);
+    }
+
+    return true;
+}
+
 // CefDownloadHandler overrides
 bool dullahan_browser_client::OnBeforeDownload(CefRefPtr<CefBrowser> browser,
     CefRefPtr<CefDownloadItem> download_item,
@@ -377,6 +506,11 @@ void dullahan_browser_client::OnDownloadUpdated(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return;
+    }
+
     bool is_in_progress = download_item->IsInProgress();
     int percent_complete = download_item->GetPercentComplete();
     bool is_complete = download_item->IsComplete();
@@ -399,6 +533,11 @@ bool dullahan_browser_client::OnFileDialog(CefRefPtr<CefBrowser> browser,
 {
     CEF_REQUIRE_UI_THREAD();
 
+    if (!mParent)
+    {
+        return false;
+    }
+
     dullahan::EFileDialogType dialog_type = dullahan::FD_UNKNOWN;
     if ((mode & 0x0f) ==  FileDialogMode::FILE_DIALOG_OPEN)
     {
@@ -461,6 +600,12 @@ bool dullahan_browser_client::OnJSDialog(CefRefPtr<CefBrowser> browser,
         CefRefPtr<CefJSDialogCallback> callback,
         bool& suppress_message)
 {
+    if (!mParent)
+    {
+        suppress_message = true;
+        return false;
+    }
+
     suppress_message = mParent->getCallbackManager()->onJSDialogCallback(std::string(origin_url),
                        std::string(message_text),
                        std::string(default_prompt_text));
@@ -473,6 +618,11 @@ bool dullahan_browser_client::OnBeforeUnloadDialog(CefRefPtr<CefBrowser> browser
         bool is_reload,
         CefRefPtr<CefJSDialogCallback> callback)
 {
+    if (!mParent)
+    {
+        return false;
+    }
+
     bool suppress_dialog = mParent->getCallbackManager()->onJSBeforeUnloadCallback();
 
     if (suppress_dialog)
@@ -28,6 +28,7 @@
 #define _DULLAHAN_BROWSER_CLIENT
 
 #include <list>
+#include <mutex>
 
 #include "cef_client.h"
 
@@ -40,6 +41,8 @@ class dullahan_browser_client :
     public CefDisplayHandler,
     public CefLoadHandler,
     public CefRequestHandler,
+    public CefResourceRequestHandler,
+    public CefCookieAccessFilter,
     public CefDownloadHandler,
     public CefDialogHandler,
     public CefJSDialogHandler
@@ -52,6 +55,18 @@ class dullahan_browser_client :
         // CefClient override
         CefRefPtr<CefRenderHandler> GetRenderHandler() override;
 
+        // hand the client (and its browser) over to another dullahan_impl - used
+        // when a browser kept ready in the engine's pool is given to a new instance
+        void setParent(dullahan_impl* parent, CefRefPtr<dullahan_render_handler> render_handler);
+
+        // nothing this client hears about reaches the parent any more - it calls this
+        // as it shuts down or swaps in a pooled client, since CEF can hold on to us
+        // (and a browser still closing) for a while after
+        void detachParent();
+
+        // the browser using this client once it has been created, otherwise null
+        CefRefPtr<CefBrowser> getBrowser();
+
         // CefLifeSpanHandler overrides
         CefRefPtr<CefLifeSpanHandler> GetLifeSpanHandler() override
         {
@@ -125,6 +140,22 @@ class dullahan_browser_client :
         bool GetAuthCredentials(CefRefPtr<CefBrowser> browser, const CefString& origin_url, bool isProxy,
                                 const CefString& host, int port, const CefString& realm,
                                 const CefString& scheme, CefRefPtr<CefAuthCallback> callback) override;
+        CefRefPtr<CefResourceRequestHandler> GetResourceRequestHandler(CefRefPtr<CefBrowser> browser,
+                                CefRefPtr<CefFrame> frame, CefRefPtr<CefRequest> request,
+                                bool is_navigation, bool is_download, const CefString& request_initiator,
+                                bool& disable_default_handling) override;
+
+        // CefResourceRequestHandler overrides - only used while there are cookie observers
+        CefRefPtr<CefCookieAccessFilter> GetCookieAccessFilter(CefRefPtr<CefBrowser> browser,
+                                CefRefPtr<CefFrame> frame, CefRefPtr<CefRequest> request) override
+        {
+            return this;
+        }
+
+        // CefCookieAccessFilter overrides
+        bool CanSaveCookie(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                           CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response,
+                           const CefCookie& cookie) override;
 
         // CefDownloadHandler overrides
         CefRefPtr<CefDownloadHandler> GetDownloadHandler() override
@@ -173,6 +204,12 @@ class dullahan_browser_client :
                                   CefRefPtr<CefJSDialogCallback> callback) override;
     private:
         dullahan_impl* mParent;
+
+        // the same parent for the IO thread overrides - only used with the lock held
+        // so it can't be swapped or cleared on the UI thread while one is using it
+        std::mutex mIOParentMutex;
+        dullahan_impl* mIOParent;
+
         CefRefPtr<CefRenderHandler> mRenderHandler;
         typedef std::list<CefRefPtr<CefBrowser>> BrowserList;
         BrowserList mBrowserList;
@@ -27,6 +27,48 @@
 #include "dullahan_impl.h"
 #include "dullahan_callback_manager.h"
 
+void dullahan_callback_manager::setDeferred(bool deferred)
+{
+    mDeferred = deferred;
+}
+
+// callbacks that only tell the consumer about something - either made right
+// away or held until deliverDeferred() is called on the consumer's thread
+void dullahan_callback_manager::defer(std::function<void()> callback)
+{
+    if (!mDeferred)
+    {
+        callback();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mDeferredMutex);
+    mDeferredCallbacks.push_back(callback);
+}
+
+void dullahan_callback_manager::deliverDeferred()
+{
+    // swapped out first - a callback is free to do something that queues another
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mDeferredMutex);
+        callbacks.swap(mDeferredCallbacks);
+    }
+
+    for (size_t i = 0; i < callbacks.size(); ++i)
+    {
+        callbacks[i]();
+    }
+}
+
+void dullahan_callback_manager::onCompletion(std::function<void()> callback)
+{
+    if (callback)
+    {
+        defer(callback);
+    }
+}
+
 void dullahan_callback_manager::setOnAddressChangeCallback(std::function<void(const std::string url)> callback)
 {
     mOnAddressChangeCallbackFunc = callback;
@@ -36,7 +78,7 @@ void dullahan_callback_manager::onAddressChange(const std::string url)
 {
     if (mOnAddressChangeCallbackFunc)
     {
-        mOnAddressChangeCallbackFunc(url);
+        defer(std::bind(mOnAddressChangeCallbackFunc, url));
     }
 }
 
@@ -50,7 +92,7 @@ void dullahan_callback_manager::onConsoleMessage(const std::string message, cons
 {
     if (mOnConsoleMessageCallbackFunc)
     {
-        mOnConsoleMessageCallbackFunc(message, source, line);
+        defer(std::bind(mOnConsoleMessageCallbackFunc, message, source, line));
     }
 }
 
@@ -64,7 +106,7 @@ void dullahan_callback_manager::onCursorChanged(const dullahan::ECursorType type
 {
     if (mOnCursorChangedCallbackFunc)
     {
-        mOnCursorChangedCallbackFunc(type);
+        defer(std::bind(mOnCursorChangedCallbackFunc, type));
     }
 }
 
@@ -77,7 +119,7 @@ void dullahan_callback_manager::onCustomSchemeURL(const std::string url, bool us
 {
     if (mOnCustomSchemeURLCallbackFunc)
     {
-        mOnCustomSchemeURLCallbackFunc(url, user_gesture, is_redirect);
+        defer(std::bind(mOnCustomSchemeURLCallbackFunc, url, user_gesture, is_redirect));
     }
 }
 
@@ -107,7 +149,7 @@ void dullahan_callback_manager::onLoadEnd(int status, const std::string url)
 {
     if (mOnLoadEndCallbackFunc)
     {
-        mOnLoadEndCallbackFunc(status, url);
+        defer(std::bind(mOnLoadEndCallbackFunc, status, url));
     }
 }
 
@@ -120,7 +162,7 @@ void dullahan_callback_manager::onLoadError(int status, const std::string error_
 {
     if (mOnLoadErrorCallbackFunc)
     {
-        mOnLoadErrorCallbackFunc(status, error_text, error_url);
+        defer(std::bind(mOnLoadErrorCallbackFunc, status, error_text, error_url));
     }
 }
 
@@ -133,7 +175,7 @@ void dullahan_callback_manager::onLoadStart()
 {
     if (mOnLoadStartCallbackFunc)
     {
-        mOnLoadStartCallbackFunc();
+        defer(mOnLoadStartCallbackFunc);
     }
 }
 
@@ -147,24 +189,88 @@ void dullahan_callback_manager::onOpenPopup(const std::string url, const std::st
 {
     if (mOnOpenPopupCallbackFunc)
     {
-        mOnOpenPopupCallbackFunc(url, target);
+        defer(std::bind(mOnOpenPopupCallbackFunc, url, target));
     }
 }
 
 void dullahan_callback_manager::setOnPageChangedCallback(
     std::function<void(const unsigned char* pixels, int x, int y, int width, int height)> callback)
 {
+    std::lock_guard<std::mutex> lock(mDeferredMutex);
     mOnPageChangedCallbackFunc = callback;
 }
 
 void dullahan_callback_manager::onPageChanged(const unsigned char* pixels, int x, int y, int width, int height)
 {
+    // the consumer gets these from deliverPageChanged(..) instead
+    if (mDeferred)
+    {
+        return;
+    }
+
     if (mOnPageChangedCallbackFunc)
     {
         mOnPageChangedCallbackFunc(pixels, x, y, width, height);
     }
 }
 
+void dullahan_callback_manager::setOnPageChangedRegionsCallback(
+    std::function<void(const unsigned char* pixels, int width, int height, const std::vector<dullahan::dullahan_rect>& dirty_rects)> callback)
+{
+    std::lock_guard<std::mutex> lock(mDeferredMutex);
+    mOnPageChangedRegionsCallbackFunc = callback;
+}
+
+void dullahan_callback_manager::onPageChangedRegions(const unsigned char* pixels, int width, int height, const std::vector<dullahan::dullahan_rect>& dirty_rects)
+{
+    if (mDeferred)
+    {
+        return;
+    }
+
+    if (mOnPageChangedRegionsCallbackFunc)
+    {
+        mOnPageChangedRegionsCallbackFunc(pixels, width, height, dirty_rects);
+    }
+}
+
+// the page changed callbacks for a frame taken from the frame exchange on the consumer's
+// thread - the regions cover everything since the last frame it took, not just one paint.
+// The callbacks themselves are copied on CEF's thread so they are read under the lock
+void dullahan_callback_manager::deliverPageChanged(const dullahan::dullahan_frame& frame)
+{
+    std::function<void(const unsigned char*, int, int, int, int)> page_changed;
+    std::function<void(const unsigned char*, int, int, const std::vector<dullahan::dullahan_rect>&)> page_changed_regions;
+    {
+        std::lock_guard<std::mutex> lock(mDeferredMutex);
+        page_changed = mOnPageChangedCallbackFunc;
+        page_changed_regions = mOnPageChangedRegionsCallbackFunc;
+    }
+
+    if (page_changed)
+    {
+        page_changed(frame.pixels, 0, 0, frame.width, frame.height);
+    }
+
+    if (page_changed_regions && !frame.dirty_rects.empty())
+    {
+        page_changed_regions(frame.pixels, frame.width, frame.height, frame.dirty_rects);
+    }
+}
+
+void dullahan_callback_manager::setOnPixelBufferResizeCallback(std::function<void(int width, int height)> callback)
+{
+    mOnPixelBufferResizeCallbackFunc = callback;
+}
+
+void dullahan_callback_manager::onPixelBufferResize(int width, int height)
+{
+    if (mOnPixelBufferResizeCallbackFunc)
+    {
+        mOnPixelBufferResizeCallbackFunc(width, height);
+    }
+}
+
 void dullahan_callback_manager::setOnStatusMessageCallback(std::function<void(const std::string message)> callback)
 {
     mOnStatusMessageCallbackFunc = callback;
@@ -174,7 +280,7 @@ void dullahan_callback_manager::onStatusMessage(const std::string message)
 {
     if (mOnStatusMessageCallbackFunc)
     {
-        mOnStatusMessageCallbackFunc(message);
+        defer(std::bind(mOnStatusMessageCallbackFunc, message));
     }
 }
 
@@ -187,7 +293,20 @@ void dullahan_callback_manager::onRequestExit()
 {
     if (mOnRequestExitCallbackFunc)
     {
-        mOnRequestExitCallbackFunc();
+        defer(mOnRequestExitCallbackFunc);
+    }
+}
+
+void dullahan_callback_manager::setOnReadyCallback(std::function<void(bool ok)> callback)
+{
+    mOnReadyCallbackFunc = callback;
+}
+
+void dullahan_callback_manager::onReady(bool ok)
+{
+    if (mOnReadyCallbackFunc)
+    {
+        defer(std::bind(mOnReadyCallbackFunc, ok));
     }
 }
 
@@ -200,7 +319,7 @@ void dullahan_callback_manager::onTitleChange(const std::string title)
 {
     if (mOnTitleChangeCallbackFunc)
     {
-        mOnTitleChangeCallbackFunc(title);
+        defer(std::bind(mOnTitleChangeCallbackFunc, title));
     }
 }
 
@@ -213,7 +332,7 @@ void dullahan_callback_manager::OnTooltip(const std::string text)
 {
     if (mOnTooltipCallbackFunc)
     {
-        mOnTooltipCallbackFunc(text);
+        defer(std::bind(mOnTooltipCallbackFunc, text));
     }
 }
 
@@ -226,7 +345,7 @@ void dullahan_callback_manager::onPdfPrintFinished(const std::string path, bool
 {
     if (mOnPdfPrintFinishedCallbackFunc)
     {
-        mOnPdfPrintFinishedCallbackFunc(path, ok);
+        defer(std::bind(mOnPdfPrintFinishedCallbackFunc, path, ok));
     }
 }
 
@@ -239,7 +358,7 @@ void dullahan_callback_manager::onFileDownloadProgress(int percent, bool level)
 {
     if (mOnFileDownloadProgressCallbackFunc)
     {
-        mOnFileDownloadProgressCallbackFunc(percent, level);
+        defer(std::bind(mOnFileDownloadProgressCallbackFunc, percent, level));
     }
 }
 
@@ -28,12 +28,26 @@
 #define _DULLAHAN_CALLBACK_MANAGER
 
 #include <functional>
+#include <mutex>
+#include <vector>
 
 #include "dullahan.h"
 
 class dullahan_callback_manager
 {
     public:
+        // when deferred, callbacks that only tell the consumer something are held until
+        // deliverDeferred() is called on the consumer's thread and the page changed ones are
+        // made from frames passed to deliverPageChanged(..). Callbacks CEF needs an answer
+        // from (and onPixelBufferResize) are still made straight away on CEF's UI thread
+        void setDeferred(bool deferred);
+        void deliverDeferred();
+        void deliverPageChanged(const dullahan::dullahan_frame& frame);
+
+        // one-off callbacks the consumer passed in with a call (cookie batches etc.) -
+        // made the same way as the notification ones
+        void onCompletion(std::function<void()> callback);
+
         void setOnAddressChangeCallback(std::function<void(const std::string url)> callback);
         void onAddressChange(const std::string url);
 
@@ -64,12 +78,21 @@ class dullahan_callback_manager
         void setOnPageChangedCallback(std::function<void(const unsigned char* pixels, int x, int y, int width, int height)> callback);
         void onPageChanged(const unsigned char* pixels, int x, int y, int width, int height);
 
+        void setOnPageChangedRegionsCallback(std::function<void(const unsigned char* pixels, int width, int height, const std::vector<dullahan::dullahan_rect>& dirty_rects)> callback);
+        void onPageChangedRegions(const unsigned char* pixels, int width, int height, const std::vector<dullahan::dullahan_rect>& dirty_rects);
+
+        void setOnPixelBufferResizeCallback(std::function<void(int width, int height)> callback);
+        void onPixelBufferResize(int width, int height);
+
         void setOnStatusMessageCallback(std::function<void(const std::string message)> callback);
         void onStatusMessage(const std::string message);
 
         void setOnRequestExitCallback(std::function<void()> callback);
         void onRequestExit();
 
+        void setOnReadyCallback(std::function<void(bool ok)> callback);
+        void onReady(bool ok);
+
         void setOnTitleChangeCallback(std::function<void(const std::string title)> callback);
         void onTitleChange(const std::string title);
 
@@ -95,6 +118,12 @@ class dullahan_callback_manager
         std::string onJStoCPPMsgCallback(const std::string id, const std::string msg);
 
     private:
+        void defer(std::function<void()> callback);
+
+        bool mDeferred = false;
+        std::mutex mDeferredMutex;
+        std::vector<std::function<void()>> mDeferredCallbacks;
+
         std::function<void(const std::string)> mOnAddressChangeCallbackFunc;
         std::function<void(const std::string, const std::string, int)> mOnConsoleMessageCallbackFunc;
         std::function<void(const dullahan::ECursorType)> mOnCursorChangedCallbackFunc;
@@ -105,8 +134,11 @@ class dullahan_callback_manager
         std::function<void()> mOnLoadStartCallbackFunc;
         std::function<void(const std::string, const std::string)> mOnOpenPopupCallbackFunc;
         std::function<void(const unsigned char*, int, int, int, int)> mOnPageChangedCallbackFunc;
+        std::function<void(const unsigned char*, int, int, const std::vector<dullahan::dullahan_rect>&)> mOnPageChangedRegionsCallbackFunc;
+        std::function<void(int, int)> mOnPixelBufferResizeCallbackFunc;
         std::function<void(const std::string)> mOnStatusMessageCallbackFunc;
         std::function<void()> mOnRequestExitCallbackFunc;
+        std::function<void(bool)> mOnReadyCallbackFunc;
         std::function<void(const std::string)> mOnTitleChangeCallbackFunc;
         std::function<void(const std::string)> mOnTooltipCallbackFunc;
         std::function<void(const std::string, bool)> mOnPdfPrintFinishedCallbackFunc;
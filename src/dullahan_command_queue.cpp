@@ -0,0 +1,88 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "dullahan_command_queue.h"
+
+#include <thread>
+
+dullahan_command_queue::dullahan_command_queue() :
+    mPending(0)
+{
+    node* stub = new node;
+    stub->next.store(nullptr, std::memory_order_relaxed);
+    mHead.store(stub, std::memory_order_relaxed);
+    mTail = stub;
+}
+
+dullahan_command_queue::~dullahan_command_queue()
+{
+    // anything still queued is dropped without being run
+    while (mTail)
+    {
+        node* next = mTail->next.load(std::memory_order_acquire);
+        delete mTail;
+        mTail = next;
+    }
+}
+
+bool dullahan_command_queue::push(std::function<void()> command)
+{
+    node* entry = new node;
+    entry->command = std::move(command);
+    entry->next.store(nullptr, std::memory_order_relaxed);
+
+    // counted before it is linked so the consumer can't finish the queue and go
+    // back to sleep in between - run() waits for the link if it gets there first
+    const bool was_empty = mPending.fetch_add(1, std::memory_order_acq_rel) == 0;
+
+    node* previous = mHead.exchange(entry, std::memory_order_acq_rel);
+    previous->next.store(entry, std::memory_order_release);
+
+    return was_empty;
+}
+
+void dullahan_command_queue::run()
+{
+    do
+    {
+        // a producer that has swapped in a new head but not linked it yet is only a
+        // couple of instructions away from doing so
+        node* next = mTail->next.load(std::memory_order_acquire);
+        while (!next)
+        {
+            std::this_thread::yield();
+            next = mTail->next.load(std::memory_order_acquire);
+        }
+
+        delete mTail;
+        mTail = next;
+
+        std::function<void()> command = std::move(next->command);
+        next->command = nullptr;
+        command();
+    }
+    while (mPending.fetch_sub(1, std::memory_order_acq_rel) > 1);
+}
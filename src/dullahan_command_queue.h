@@ -0,0 +1,68 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef _DULLAHAN_COMMAND_QUEUE
+#define _DULLAHAN_COMMAND_QUEUE
+
+#include <atomic>
+#include <functional>
+
+// Commands for CEF's UI thread from any number of other threads. Adding one never
+// takes a lock - each producer swaps itself in as the new head and links the old
+// one to it. A single consumer (the UI thread) takes them off the tail in order
+class dullahan_command_queue
+{
+    public:
+        dullahan_command_queue();
+        ~dullahan_command_queue();
+
+        // queue a command - may be called from any thread. Returns true if the queue
+        // was empty, in which case the caller has to arrange for run() to be called
+        bool push(std::function<void()> command);
+
+        // run commands until the queue is empty - only one thread may call this at a
+        // time and only after a push(..) returned true. Commands pushed while it is
+        // running are run too
+        void run();
+
+    private:
+        struct node
+        {
+            std::function<void()> command;
+            std::atomic<node*> next;
+        };
+
+        // producers append at the head, the consumer owns the tail - which is
+        // always a node whose command has already been run (or the initial one)
+        std::atomic<node*> mHead;
+        node* mTail;
+
+        // commands pushed but not yet run - push(..) seeing it go from 0 to 1 is
+        // what tells a producer it has to wake the consumer
+        std::atomic<int> mPending;
+};
+
+#endif // _DULLAHAN_COMMAND_QUEUE
@@ -0,0 +1,350 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "dullahan_cookie_file.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace
+{
+const char BINARY_MAGIC[4] = { 'D', 'L', 'C', 'K' };
+const uint32_t BINARY_VERSION = 1;
+
+const uint8_t FLAG_SECURE = 0x01;
+const uint8_t FLAG_HTTPONLY = 0x02;
+const uint8_t FLAG_HOST_ONLY = 0x04;
+
+// Netscape files mark HttpOnly cookies by putting this in front of the domain
+const std::string HTTPONLY_PREFIX = "#HttpOnly_";
+
+// cookies CEF hands out without a leading '.' on the domain are only sent to that host
+bool isHostOnly(const dullahan::dullahan_cookie& cookie)
+{
+    return !cookie.domain.empty() && cookie.domain[0] != '.';
+}
+
+// a URL the cookie could have come from - CEF won't set one without. A host only
+// cookie loses its domain so CEF takes the host from the URL and doesn't turn it
+// into one for every subdomain too
+void makeCookieURL(dullahan::dullahan_cookie& cookie, bool host_only)
+{
+    std::string host = cookie.domain;
+    if (!host.empty() && host[0] == '.')
+    {
+        host.erase(0, 1);
+    }
+
+    cookie.url = std::string(cookie.secure ? "https://" : "http://") + host + (cookie.path.empty() ? "/" : cookie.path);
+    if (host_only)
+    {
+        cookie.domain.clear();
+    }
+}
+
+// all numbers in the binary format are little endian whatever we run on
+void putUint32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+void putInt64(std::string& out, int64_t value)
+{
+    const uint64_t bits = static_cast<uint64_t>(value);
+    for (int i = 0; i < 8; ++i)
+    {
+        out.push_back(static_cast<char>((bits >> (i * 8)) & 0xff));
+    }
+}
+
+void putString(std::string& out, const std::string& value)
+{
+    putUint32(out, static_cast<uint32_t>(value.size()));
+    out.append(value);
+}
+
+// walks a buffer read from a binary file - every get fails once it runs out
+class binary_reader
+{
+    public:
+        explicit binary_reader(const std::string& data) :
+            mData(data),
+            mPos(0)
+        {
+        }
+
+        bool getBytes(void* dst, size_t size)
+        {
+            if (mData.size() - mPos < size)
+            {
+                return false;
+            }
+            memcpy(dst, mData.data() + mPos, size);
+            mPos += size;
+            return true;
+        }
+
+        bool getUint32(uint32_t& value)
+        {
+            unsigned char bytes[4];
+            if (!getBytes(bytes, sizeof(bytes)))
+            {
+                return false;
+            }
+            value = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                value |= static_cast<uint32_t>(bytes[i]) << (i * 8);
+            }
+            return true;
+        }
+
+        bool getInt64(int64_t& value)
+        {
+            unsigned char bytes[8];
+            if (!getBytes(bytes, sizeof(bytes)))
+            {
+                return false;
+            }
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                bits |= static_cast<uint64_t>(bytes[i]) << (i * 8);
+            }
+            value = static_cast<int64_t>(bits);
+            return true;
+        }
+
+        bool getString(std::string& value)
+        {
+            uint32_t size;
+            if (!getUint32(size) || mData.size() - mPos < size)
+            {
+                return false;
+            }
+            value.assign(mData, mPos, size);
+            mPos += size;
+            return true;
+        }
+
+    private:
+        const std::string& mData;
+        size_t mPos;
+};
+
+void saveBinary(const std::vector<dullahan::dullahan_cookie>& cookies, std::string& out)
+{
+    out.append(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    putUint32(out, BINARY_VERSION);
+    putUint32(out, static_cast<uint32_t>(cookies.size()));
+
+    for (size_t i = 0; i < cookies.size(); ++i)
+    {
+        const dullahan::dullahan_cookie& cookie = cookies[i];
+
+        uint8_t flags = 0;
+        flags |= cookie.secure ? FLAG_SECURE : 0;
+        flags |= cookie.httponly ? FLAG_HTTPONLY : 0;
+        flags |= isHostOnly(cookie) ? FLAG_HOST_ONLY : 0;
+        out.push_back(static_cast<char>(flags));
+
+        putInt64(out, cookie.expires);
+        putString(out, cookie.name);
+        putString(out, cookie.value);
+        putString(out, cookie.domain);
+        putString(out, cookie.path);
+    }
+}
+
+bool loadBinary(const std::string& data, std::vector<dullahan::dullahan_cookie>& cookies)
+{
+    binary_reader reader(data);
+
+    char magic[sizeof(BINARY_MAGIC)];
+    uint32_t version;
+    uint32_t count;
+    if (!reader.getBytes(magic, sizeof(magic)) || !reader.getUint32(version) || !reader.getUint32(count))
+    {
+        return false;
+    }
+    if (version != BINARY_VERSION)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        dullahan::dullahan_cookie cookie;
+        uint8_t flags;
+        if (!reader.getBytes(&flags, sizeof(flags)) ||
+                !reader.getInt64(cookie.expires) ||
+                !reader.getString(cookie.name) ||
+                !reader.getString(cookie.value) ||
+                !reader.getString(cookie.domain) ||
+                !reader.getString(cookie.path))
+        {
+            return false;
+        }
+
+        cookie.secure = (flags & FLAG_SECURE) != 0;
+        cookie.httponly = (flags & FLAG_HTTPONLY) != 0;
+        makeCookieURL(cookie, (flags & FLAG_HOST_ONLY) != 0);
+        cookies.push_back(cookie);
+    }
+
+    return true;
+}
+
+// domain <tab> subdomains too <tab> path <tab> secure <tab> expires <tab> name <tab> value
+void saveNetscape(const std::vector<dullahan::dullahan_cookie>& cookies, std::string& out)
+{
+    std::ostringstream stream;
+    stream << "# Netscape HTTP Cookie File\n";
+
+    for (size_t i = 0; i < cookies.size(); ++i)
+    {
+        const dullahan::dullahan_cookie& cookie = cookies[i];
+
+        stream << (cookie.httponly ? HTTPONLY_PREFIX : "") << cookie.domain << '\t'
+               << (isHostOnly(cookie) ? "FALSE" : "TRUE") << '\t'
+               << (cookie.path.empty() ? "/" : cookie.path) << '\t'
+               << (cookie.secure ? "TRUE" : "FALSE") << '\t'
+               << cookie.expires << '\t'
+               << cookie.name << '\t'
+               << cookie.value << '\n';
+    }
+
+    out = stream.str();
+}
+
+bool loadNetscape(const std::string& data, std::vector<dullahan::dullahan_cookie>& cookies)
+{
+    std::istringstream stream(data);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        dullahan::dullahan_cookie cookie;
+        if (line.compare(0, HTTPONLY_PREFIX.size(), HTTPONLY_PREFIX) == 0)
+        {
+            cookie.httponly = true;
+            line.erase(0, HTTPONLY_PREFIX.size());
+        }
+        else if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (fields.size() < 6)
+        {
+            const size_t tab = line.find('\t', start);
+            if (tab == std::string::npos)
+            {
+                break;
+            }
+            fields.push_back(line.substr(start, tab - start));
+            start = tab + 1;
+        }
+
+        // the value is everything after the last tab and may be empty
+        if (fields.size() != 6)
+        {
+            continue;
+        }
+
+        cookie.domain = fields[0];
+        cookie.path = fields[2];
+        cookie.secure = fields[3] == "TRUE";
+        cookie.expires = std::strtoll(fields[4].c_str(), nullptr, 10);
+        cookie.name = fields[5];
+        cookie.value = line.substr(start);
+        makeCookieURL(cookie, fields[1] == "FALSE");
+        cookies.push_back(cookie);
+    }
+
+    return true;
+}
+}
+
+bool dullahan_cookie_file::save(const std::string& path, dullahan::ECookieFileFormat format,
+                                const std::vector<dullahan::dullahan_cookie>& cookies)
+{
+    // built up in memory and written with one call
+    std::string data;
+    if (format == dullahan::CF_NETSCAPE)
+    {
+        saveNetscape(cookies, data);
+    }
+    else
+    {
+        saveBinary(cookies, data);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+
+    file.write(data.data(), data.size());
+    return file.good();
+}
+
+bool dullahan_cookie_file::load(const std::string& path, std::vector<dullahan::dullahan_cookie>& cookies)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    const std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    const bool binary = data.size() >= sizeof(BINARY_MAGIC) &&
+                        memcmp(data.data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+
+    std::vector<dullahan::dullahan_cookie> loaded;
+    if (!(binary ? loadBinary(data, loaded) : loadNetscape(data, loaded)))
+    {
+        return false;
+    }
+
+    cookies.insert(cookies.end(), loaded.begin(), loaded.end());
+    return true;
+}
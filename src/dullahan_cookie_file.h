@@ -0,0 +1,50 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef _DULLAHAN_COOKIE_FILE
+#define _DULLAHAN_COOKIE_FILE
+
+#include <string>
+#include <vector>
+
+#include "dullahan.h"
+
+// Reading and writing a whole cookie jar in one go. CF_BINARY is our own compact
+// format ("DLCK" followed by length prefixed records) and is the quick one -
+// CF_NETSCAPE is the cookies.txt format curl, wget and browser add-ons use.
+namespace dullahan_cookie_file
+{
+    // write the cookies to path in the given format, replacing what was there
+    bool save(const std::string& path, dullahan::ECookieFileFormat format,
+              const std::vector<dullahan::dullahan_cookie>& cookies);
+
+    // read cookies from path in whichever format it is in. Cookies read back have
+    // their url made up from the domain and path so they can be set again - host
+    // only ones have an empty domain so they are set for that host alone
+    bool load(const std::string& path, std::vector<dullahan::dullahan_cookie>& cookies);
+}
+
+#endif // _DULLAHAN_COOKIE_FILE
@@ -0,0 +1,1194 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifdef __APPLE__
+#import <Cocoa/Cocoa.h>
+#endif
+
+#include "dullahan_engine_impl.h"
+#include "dullahan_impl.h"
+#include "dullahan_browser_client.h"
+#include "dullahan_render_handler.h"
+
+#include "include/cef_request_context.h"
+#include "include/cef_task.h"
+#include "include/cef_waitable_event.h"
+#include "include/wrapper/cef_helpers.h"
+#ifdef __APPLE__
+#include "include/wrapper/cef_library_loader.h"
+#endif
+
+#ifdef __linux__
+#include "dullahan_impl_linux.cpp"
+#elif WIN32
+#include "dullahan_impl_windows.cpp"
+#include <winnls.h> // for WideCharToMultiByte
+#else
+#include "dullahan_impl_mac.cpp"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+namespace
+{
+    // CEF doesn't schedule all the work it needs doing so we never
+    // go longer than this between updates - same as cefclient does
+    const int64_t MAX_PUMP_DELAY_MS = 1000 / 30;
+
+    // how long init(..) waits for CEF to say it is ready before giving up
+    const int MAX_READY_WAIT_MS = 10000;
+
+    // and how long shutdown() waits for pooled browsers to close
+    const int MAX_POOL_CLOSE_MS = 2000;
+
+    // posted to CEF's UI thread whenever the engine's command queue stops being empty
+    class command_task :
+        public CefTask
+    {
+        public:
+            explicit command_task(CefRefPtr<dullahan_engine_impl> engine) :
+                mEngine(engine)
+            {
+            }
+
+            void Execute() override
+            {
+                mEngine->runCommands();
+            }
+
+        private:
+            CefRefPtr<dullahan_engine_impl> mEngine;
+
+            IMPLEMENT_REFCOUNTING(command_task);
+    };
+}
+
+dullahan_engine_impl::dullahan_engine_impl() :
+    mInitialized(false),
+    mMultiThreaded(false),
+    mReady(false),
+    mReadyEvent(nullptr),
+    mRequestContext(nullptr),
+    mBrowserPoolSize(0),
+    mPoolWidth(0),
+    mPoolHeight(0),
+    mPoolHits(0),
+    mPoolMisses(0),
+    mPumpScheduled(false),
+    mPumpTimerFd(-1),
+    mBrowserWorkQueued(false),
+    mSystemFlashEnabled(false),
+    mMediaStreamEnabled(false),
+    mBeginFrameScheduling(false),
+    mForceWaveAudio(false),
+    mDisableGPU(true),
+    mDisableWebSecurity(false),
+    mAllowFileAccessFromFiles(false),
+    mDisableNetworkService(false),
+    mUseMockKeyChain(false),
+    mAutoPlayWithoutGesture(false),
+    mFakeUIForMediaStream(false),
+    mCookiesEnabled(true),
+    mCacheSizeMB(0)
+{
+    DLNOUT("dullahan_engine_impl::dullahan_engine_impl()");
+}
+
+dullahan_engine_impl::~dullahan_engine_impl()
+{
+    DLNOUT("dullahan_engine_impl::~dullahan_engine_impl()");
+
+#ifdef __linux__
+    if (mPumpTimerFd != -1)
+    {
+        close(mPumpTimerFd);
+    }
+#endif
+}
+
+void dullahan_engine_impl::OnBeforeCommandLineProcessing(const CefString& process_type,
+        CefRefPtr<CefCommandLine> command_line)
+{
+    if (process_type.empty())
+    {
+        // <ND> Enable HTMLImports to get youtube live chat to work
+        command_line->AppendSwitchWithValue("enable-blink-features", "HTMLImports");
+        if (mMediaStreamEnabled == true)
+        {
+            command_line->AppendSwitch("enable-media-stream");
+        }
+
+        if (mSystemFlashEnabled == true)
+        {
+            command_line->AppendSwitch("enable-system-flash");
+        }
+
+        if (mBeginFrameScheduling == true)
+        {
+            command_line->AppendSwitch("enable-begin-frame-scheduling");
+        }
+
+        // The ability to access local files used to be a member of CefBrowserSettings but
+        // now is is configured globally via command line switch (https://github.com/cefsharp/CefSharp/issues/3668)
+        if (mAllowFileAccessFromFiles == true)
+        {
+            command_line->AppendSwitch("allow-file-access-from-files");
+        }
+
+        // <ND> n.b. be careful enabling this. At least on Linux it will break sites like twitch.tv mixer.com, dlive.com.
+        // Probably this also makes only sense for Win32?
+
+        if (mDisableGPU == true)
+        {
+            command_line->AppendSwitch("disable-gpu");
+            command_line->AppendSwitch("disable-gpu-compositing");
+        }
+
+        if (mDisableWebSecurity)
+        {
+            command_line->AppendSwitch("disable-web-security");
+        }
+
+        if (mDisableNetworkService)
+        {
+            command_line->AppendSwitchWithValue("disable-features", "NetworkService");
+        }
+
+        if (mUseMockKeyChain)
+        {
+            command_line->AppendSwitch("use-mock-keychain");
+        }
+
+        if (mAutoPlayWithoutGesture)
+        {
+            command_line->AppendSwitchWithValue("autoplay-policy", "no-user-gesture-required");
+        }
+
+        if (mFakeUIForMediaStream)
+        {
+            command_line->AppendSwitch("use-fake-ui-for-media-stream");
+        }
+
+        if (mProxyHostPort.length())
+        {
+            command_line->AppendSwitchWithValue("--proxy-server", mProxyHostPort);
+        }
+
+        // Chromium has no per context setting for this - the same cap applies to the
+        // disk cache and to the in-memory one an ephemeral request context uses
+        if (mCacheSizeMB > 0)
+        {
+            command_line->AppendSwitchWithValue("disk-cache-size", std::to_string(static_cast<int64_t>(mCacheSizeMB) * 1024 * 1024));
+        }
+
+        // Hardcode the switch to turn off the HTTP Basic Auth dialogs
+        // as per this issue: https://github.com/chromiumembedded/cef/issues/3603
+        // Having these dialogs appear with new (139) version of the CEF is
+        // regarded as a griefing vector - easy to create a prim with media
+        // that spams these dialogs / taskbar icons to the user.
+        // This change lets us intercept the auth request as before and deal with
+        // it using native Viewer UI as before.
+        // Details captured in this GHI: https://github.com/secondlife/viewer-private/issues/489
+        command_line->AppendSwitch("disable-chrome-login-prompt");
+
+        platformAddCommandLines(command_line);
+    }
+}
+
+#ifdef WIN32
+// copied from viewer's llstring.h
+std::string convert_wide_to_string(const wchar_t* in, unsigned int code_page)
+{
+    std::string out;
+    if (in)
+    {
+        int len_in = (int)wcslen(in);
+        int len_out = WideCharToMultiByte(
+            code_page,
+            0,
+            in,
+            len_in,
+            NULL,
+            0,
+            0,
+            0);
+        // We will need two more bytes for the double NULL ending
+        // created in WideCharToMultiByte().
+        char* pout = new char[len_out + 2];
+        memset(pout, 0, len_out + 2);
+        if (pout)
+        {
+            WideCharToMultiByte(
+                code_page,
+                0,
+                in,
+                len_in,
+                pout,
+                len_out,
+                0,
+                0);
+            out.assign(pout);
+            delete[] pout;
+        }
+    }
+    return out;
+}
+#endif
+
+bool dullahan_engine_impl::init(dullahan::dullahan_settings& user_settings)
+{
+    DLNOUT("dullahan_engine_impl::init()");
+
+    if (!initAsync(user_settings))
+    {
+        return false;
+    }
+
+    return waitUntilReady();
+}
+
+bool dullahan_engine_impl::initAsync(dullahan::dullahan_settings& user_settings)
+{
+    DLNOUT("dullahan_engine_impl::initAsync()");
+
+    if (mInitialized)
+    {
+        return true;
+    }
+
+    // a profile from the pool rather than one the consumer picked - they
+    // can see which in root_cache_path since the settings are theirs
+    if (!user_settings.profile_pool_path.empty() && user_settings.root_cache_path.empty())
+    {
+        mProfilePool.init(user_settings.profile_pool_path, user_settings.profile_pool_max_profiles,
+                          user_settings.profile_pool_max_size_mb, user_settings.profile_pool_max_unused_days);
+        user_settings.root_cache_path = mProfilePool.lease();
+
+        // CEF would run without a cache path at all - or share one - rather than fail
+        if (user_settings.root_cache_path.empty())
+        {
+            DLNOUT("Unable to lease a profile from " << user_settings.profile_pool_path);
+            return false;
+        }
+
+        // sizing up big caches takes a while so the pool is trimmed while CEF starts
+        mProfilePool.collectGarbageAsync();
+    }
+
+    platormInitWidevine(user_settings.root_cache_path);
+
+#ifdef __linux__
+    // readable whenever CEF has work for update() to do
+    if (mPumpTimerFd == -1)
+    {
+        mPumpTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+#endif
+
+#ifdef WIN32
+    CefMainArgs args(GetModuleHandle(nullptr));
+#elif __APPLE__
+    CefScopedLibraryLoader library_loader;
+    if (!library_loader.LoadInMain())
+    {
+        return false;
+    }
+
+    CefMainArgs args(0, nullptr);
+#endif
+#ifdef __linux__
+    CefMainArgs args(0, nullptr);
+#endif
+
+    CefSettings settings;
+
+    // point to host application helper
+#ifdef WIN32
+    // Note: as of CEF 83, it appears that on Windows builds, the path to the host
+    // helper application must be an absolute path vs the existing, relative path.
+    // If the user has not specified a path to the helper explicitly, then we can,
+    // as a first pass, assume it's located next to the executable (it often is)
+    // and for use cases where it is located elsewhere, the consumer can specify
+    // the absolute path directly.
+    std::string host_process_path = user_settings.host_process_path;
+    if (host_process_path.empty())
+    {
+        // path is not specified so assume it's adjacent to the executable
+        std::vector<wchar_t> exe_path(MAX_PATH + 1);
+        GetModuleFileNameW(NULL, &exe_path[0], MAX_PATH);
+        std::string cur_exe_path = convert_wide_to_string(&exe_path[0], CP_UTF8);
+        const size_t last_slash_idx = cur_exe_path.find_last_of("\\/");
+        if (last_slash_idx == std::string::npos)
+        {
+            return false;
+        }
+        host_process_path = cur_exe_path.erase(last_slash_idx + 1);
+    }
+
+    // finally, tell CEF where to find the host process helper
+    CefString(&settings.browser_subprocess_path) = host_process_path + "\\" + user_settings.host_process_filename;
+
+    settings.no_sandbox = true;
+#elif __APPLE__
+    NSString* appBundlePath = [[NSBundle mainBundle] bundlePath];
+    CefString(&settings.browser_subprocess_path) =
+        [[NSString stringWithFormat:
+          @"%@/Contents/Frameworks/DullahanHelper.app/Contents/MacOS/DullahanHelper", appBundlePath] UTF8String];
+
+    CefString(&settings.framework_dir_path) =
+    [[NSString stringWithFormat:
+      @"%@/Contents/Frameworks/Chromium Embedded Framework.framework", appBundlePath] UTF8String];
+
+	settings.no_sandbox = true;
+#elif __linux__
+    CefString(&settings.browser_subprocess_path) = getExeCwd() + "/dullahan_host";
+    bool useSandbox = false;
+    std::string sandboxName = getExeCwd() + "/chrome-sandbox";
+    struct stat st;
+
+    if (!stat(sandboxName.c_str(), &st))
+    {
+        // Sandbox must be owned by root:root and has the suid bit set, otherwise cef won't use it.
+        if (st.st_uid == 0 && st.st_gid == 0 && (st.st_mode & S_ISUID) == S_ISUID)
+        {
+            useSandbox = true;
+        }
+    }
+
+    settings.no_sandbox = !useSandbox;
+#else
+#error "Unsupported Platform"
+#endif
+    // required for CEF 72+ to indicate headless
+    settings.windowless_rendering_enabled = true;
+
+#ifdef __APPLE__
+    // CEF can only run its own UI thread on Windows and Linux
+    mMultiThreaded = false;
+#else
+    mMultiThreaded = user_settings.multi_threaded_message_loop;
+#endif
+
+    // CEF header file suggest that we need this now - unless CEF runs the loop itself
+    settings.external_message_pump = !mMultiThreaded;
+
+    // use a single thread for the message loop unless asked to let CEF run its own
+    settings.multi_threaded_message_loop = mMultiThreaded;
+
+    // act like a browser and do not persist session cookies ever
+    settings.persist_session_cookies = user_settings.cookies_enabled;
+
+    // explicitly set the path to the locales folder since defaults no longer work on some systems
+    CefString(&settings.locales_dir_path) = user_settings.locales_dir_path;
+
+    // set path to root cache if enabled and set
+    CefString(&settings.root_cache_path) = user_settings.root_cache_path;
+#ifdef WIN32
+    CefString(&settings.cache_path) = user_settings.root_cache_path + "\\" + "cache";
+#else
+    CefString(&settings.cache_path) = user_settings.root_cache_path + "/" + "cache";
+#endif
+
+    // as of CEF 90, the new way to disable cookies
+    if (user_settings.cookies_enabled == false)
+    {
+        CefString(&settings.cookieable_schemes_list) = "";
+        settings.cookieable_schemes_exclude_defaults = true;
+    }
+
+    // insert a new string into user agent
+    if (user_settings.user_agent_substring.length())
+    {
+        std::string user_agent(user_settings.user_agent_substring);
+        cef_string_utf8_to_utf16(user_agent.c_str(), user_agent.size(), &settings.user_agent_product);
+    }
+    else
+    {
+        std::string user_agent = dullahan_impl::makeCompatibleUserAgentString("");
+        cef_string_utf8_to_utf16(user_agent.c_str(), user_agent.size(), &settings.user_agent_product);
+    }
+
+    // the proxy host:port to use
+    mProxyHostPort = user_settings.proxy_host_port;
+
+    // kept for request contexts created later on - see createEphemeralRequestContext()
+    mAcceptLanguageList = user_settings.accept_language_list;
+    mCookiesEnabled = user_settings.cookies_enabled;
+
+    // cap on each HTTP cache - 0 leaves it to Chromium
+    mCacheSizeMB = std::max(user_settings.cache_size_mb, 0);
+
+    // list of language locale codes used to configure the Accept-Language HTTP header value
+    if (user_settings.accept_language_list.length())
+    {
+        std::string accept_language_list(user_settings.accept_language_list);
+        cef_string_utf8_to_utf16(accept_language_list.c_str(),
+                                 accept_language_list.size(), &settings.accept_language_list);
+    }
+
+    // enable/disable use of system Flash
+    mSystemFlashEnabled = user_settings.plugins_enabled & user_settings.flash_enabled;
+
+    // enable/disable media stream (web cams etc.)
+    // IMPORTANT: there is no "Use Your WebCam OK?" dialog so enable this at your peril
+    mMediaStreamEnabled = user_settings.media_stream_enabled;
+
+    // this flag needed for some video cards to force onPaints to work - off by default
+    mBeginFrameScheduling = user_settings.begin_frame_scheduling;
+
+#ifdef WIN32
+    // this flag forces Windows WaveOut/In audio API even if Core Audio is supported
+    mForceWaveAudio = user_settings.force_wave_audio;
+#endif
+
+    // this flag if set, adds command line options to disable the GPU and GPU compositing.
+    // Appears to be needed to make sites like Google Maps work now. The GPU compositing
+    // needs to be off to allow videos to play back without stutter. For the moment, it is
+    // recommended that this option always be enabled.
+    mDisableGPU = user_settings.disable_gpu;
+
+    // this flag if set, adds command line parameters to disable the web security component
+    // that prohibits you from browsing local files.  It is used in the 360 Capture feature
+    // in the viewer to open a web page that references locally generated images without
+    // needing a web server.
+    mDisableWebSecurity = user_settings.disable_web_security;
+
+    // this flag allows access to local files - it used to be set via a member of CefBrowserSettings
+    // but now must be set via the command line so we capture it here
+    mAllowFileAccessFromFiles = user_settings.file_access_from_file_urls;
+
+    // this flag if set, adds a command line parameter that disables "network service" and
+    // is like adding --disable-features=NetworkService. This appears to be required after
+    // Chrome 75 to disable the "Chrome wants access to passwords" dialog on macOS that
+    // started to appear. May change later.
+    mDisableNetworkService = user_settings.disable_network_service;
+
+    // this flag if set, adds a command line parameter that replaces disable_network_service
+    // flag to bypass the dialog on macOS that appears in Chrome 79+ to disable the
+    // "Chrome wants access to passwords" dialog on macOS that started to appear.
+    mUseMockKeyChain = user_settings.use_mock_keychain;
+
+    // this flag, if set, allows video/audio to autoplay if the URL parameters are configured
+    // correctly to do so. (by default as of Chrome 70, audio/video does not autoplay)
+    mAutoPlayWithoutGesture = user_settings.autoplay_without_gesture;
+
+    // this flag, if set allows you to bypass UI like "This page wants to use
+    // your microphone" and accept the request. Obviously, use with caution -
+    // eventually, this will be implemented as a callback so the consumer can
+    // provide their own ("Allow, "Disallow") UI.
+    mFakeUIForMediaStream = user_settings.fake_ui_for_media_stream;
+
+    // log file settings
+    CefString(&settings.log_file) = user_settings.log_file;
+    settings.log_severity = user_settings.log_verbose ? LOGSEVERITY_VERBOSE : LOGSEVERITY_DEFAULT;
+
+	if (user_settings.enable_remote_debug)
+	{
+		// allow Chrome (or other CEF windoW) to debug at http://localhost::PORT_NUMBER
+		settings.remote_debugging_port = user_settings.remote_debugging_port;
+	}
+
+    // browsers kept ready for new instances - created in the background by update()
+    dullahan_impl::makeBrowserSettings(user_settings, mPoolBrowserSettings);
+    mPoolBrowserSettings.windowless_frame_rate = 1;
+    mPoolWidth = user_settings.initial_width;
+    mPoolHeight = user_settings.initial_height;
+    mBrowserPoolSize = std::max(user_settings.browser_pool_size, 0);
+
+    // initiaize CEF - the request context browsers need isn't ready until
+    // OnContextInitialized() is called from the message loop
+    bool automatically_reset = false;
+    bool initially_signaled = false;
+    mReadyEvent = CefWaitableEvent::CreateWaitableEvent(automatically_reset, initially_signaled);
+
+    if (!CefInitialize(args, settings, this, nullptr))
+    {
+        mProfilePool.release();
+        return false;
+    }
+
+    mInitialized = true;
+
+    return true;
+}
+
+// CefBrowserProcessHandler override - CEF's UI thread, once the global request
+// context can be used. Browsers that were waiting for it are created now
+void dullahan_engine_impl::OnContextInitialized()
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    // every browser in the engine shares this one
+    mRequestContext = CefRequestContext::GetGlobalContext();
+    mReady = true;
+    if (mReadyEvent.get())
+    {
+        mReadyEvent->Signal();
+    }
+
+    std::vector<dullahan_impl*> browsers;
+    {
+        std::lock_guard<std::mutex> lock(mBrowsersMutex);
+        browsers = mBrowsers;
+    }
+
+    for (size_t i = 0; i < browsers.size(); ++i)
+    {
+        bool still_open;
+        {
+            std::lock_guard<std::mutex> lock(mBrowsersMutex);
+            still_open = std::find(mBrowsers.begin(), mBrowsers.end(), browsers[i]) != mBrowsers.end();
+        }
+
+        if (still_open)
+        {
+            browsers[i]->onEngineReady();
+        }
+    }
+}
+
+// give CEF turns (or just time if it runs its own thread) until it is ready
+bool dullahan_engine_impl::waitUntilReady()
+{
+    if (mMultiThreaded)
+    {
+        // CEF's own UI thread gets there - just block until it says so
+        if (mInitialized && !mReady && mReadyEvent.get())
+        {
+            mReadyEvent->TimedWait(MAX_READY_WAIT_MS);
+        }
+    }
+    else
+    {
+        // the message loop is ours so give it turns, sleeping until CEF next wants one
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MAX_READY_WAIT_MS);
+        while (mInitialized && !mReady)
+        {
+            update();
+
+            const auto now = std::chrono::steady_clock::now();
+            if (mReady || now >= deadline)
+            {
+                break;
+            }
+
+            const int64_t remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min((int64_t)getUpdateDelay(), remaining_ms)));
+        }
+    }
+
+    if (!mReady)
+    {
+        DLNOUT("CEF request context wasn't ready in time");
+    }
+
+    return mReady;
+}
+
+void dullahan_engine_impl::shutdown()
+{
+    if (!mInitialized)
+    {
+        return;
+    }
+
+    if (getBrowserCount() > 0)
+    {
+        DLNOUT("Shutting down engine with " << getBrowserCount() << " browsers still in it");
+    }
+
+    mShutdownStats = dullahan::dullahan_shutdown_stats();
+
+    const auto start = std::chrono::steady_clock::now();
+    closeBrowserPool();
+    const auto pool_closed = std::chrono::steady_clock::now();
+
+    mRequestContext = nullptr;
+    mInitialized = false;
+    mReady = false;
+
+    // on the thread that called CefInitialize(..) even when CEF runs its own UI thread
+    CefShutdown();
+
+    mShutdownStats.pool_close_us = std::chrono::duration_cast<std::chrono::microseconds>(pool_closed - start).count();
+    mShutdownStats.cef_shutdown_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pool_closed).count();
+    DLNOUT("Engine shut down - pool " << mShutdownStats.pool_close_us << "us, CEF " << mShutdownStats.cef_shutdown_us << "us");
+
+    // nothing runs on CEF's thread now so commands aren't queued for it any more
+    mMultiThreaded = false;
+
+    // CEF has finished with the profile so the next instance can have it
+    mProfilePool.release();
+}
+
+bool dullahan_engine_impl::isInitialized()
+{
+    return mInitialized;
+}
+
+bool dullahan_engine_impl::isReady()
+{
+    return mReady;
+}
+
+void dullahan_engine_impl::run()
+{
+    if (mMultiThreaded)
+    {
+        // CEF already has a loop of its own so this one just hands out
+        // callbacks until the engine is shut down from one of them
+        while (mInitialized)
+        {
+            update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::max(getUpdateDelay(), 1)));
+        }
+        return;
+    }
+
+    CefRunMessageLoop();
+}
+
+void dullahan_engine_impl::update()
+{
+    update(0);
+}
+
+// Give CEF turns until it has nothing due or the budget is used up, then let each
+// browser do its own work. Every turn is timed so consumers can see what CEF costs.
+// When CEF runs its own UI thread there are no turns to give it and this just
+// hands out the callbacks that were held for the consumer's thread
+dullahan::dullahan_update_result dullahan_engine_impl::update(int64_t budget_us)
+{
+    dullahan::dullahan_update_result result;
+    if (!mInitialized)
+    {
+        return result;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if (mMultiThreaded)
+    {
+        // CEF doesn't need turns - the browsers' own work is queued for its thread (once,
+        // however often we are called) and their callbacks are handed out on this one
+        if (!mBrowserWorkQueued.exchange(true))
+        {
+            CefRefPtr<dullahan_engine_impl> engine(this);
+            post([engine]()
+            {
+                engine->mBrowserWorkQueued = false;
+                engine->updateBrowsers();
+                engine->refillBrowserPool();
+            });
+        }
+
+        deliverCallbacks();
+    }
+    else
+    {
+        int64_t elapsed_us = 0;
+        do
+        {
+            // whatever CEF asked for is about to be done - anything else it wants
+            // while doing it is scheduled again from OnScheduleMessagePumpWork(..)
+            {
+                std::lock_guard<std::mutex> lock(mPumpMutex);
+                mPumpScheduled = false;
+
+#ifdef __linux__
+                // clear the timer so poll() stops reporting it - fails harmlessly if it hadn't gone off
+                if (mPumpTimerFd != -1)
+                {
+                    uint64_t expirations;
+                    const ssize_t bytes = read(mPumpTimerFd, &expirations, sizeof(expirations));
+                    (void)bytes;
+                }
+#endif
+            }
+
+            const auto slice_start = std::chrono::steady_clock::now();
+            CefDoMessageLoopWork();
+            const auto slice_end = std::chrono::steady_clock::now();
+
+            const int64_t slice_us = std::chrono::duration_cast<std::chrono::microseconds>(slice_end - slice_start).count();
+            mUpdateStats.max_slice_us = std::max(mUpdateStats.max_slice_us, slice_us);
+            ++mUpdateStats.slices;
+            ++result.slices;
+
+            elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(slice_end - start).count();
+        }
+        while (budget_us > 0 && elapsed_us < budget_us && isPumpWorkDue());
+
+        updateBrowsers();
+        refillBrowserPool();
+    }
+
+    result.work_remaining = isPumpWorkDue();
+    schedulePumpWork(MAX_PUMP_DELAY_MS);
+
+    result.time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    ++mUpdateStats.updates;
+    mUpdateStats.total_time_us += result.time_us;
+    mUpdateStats.max_time_us = std::max(mUpdateStats.max_time_us, result.time_us);
+    if (budget_us > 0 && result.time_us > budget_us)
+    {
+        ++mUpdateStats.over_budget;
+    }
+
+    return result;
+}
+
+// each browser's own work after CEF has had its turn - always on CEF's UI thread
+void dullahan_engine_impl::updateBrowsers()
+{
+    // a browser can be shut down from one of its own callbacks so walk a copy
+    std::vector<dullahan_impl*> browsers;
+    {
+        std::lock_guard<std::mutex> lock(mBrowsersMutex);
+        browsers = mBrowsers;
+    }
+
+    for (size_t i = 0; i < browsers.size(); ++i)
+    {
+        bool still_open;
+        {
+            std::lock_guard<std::mutex> lock(mBrowsersMutex);
+            still_open = std::find(mBrowsers.begin(), mBrowsers.end(), browsers[i]) != mBrowsers.end();
+        }
+
+        if (still_open)
+        {
+            browsers[i]->updateBrowser();
+        }
+    }
+}
+
+// callbacks held back for the thread update() is called on
+void dullahan_engine_impl::deliverCallbacks()
+{
+    std::vector<dullahan_impl*> browsers;
+    {
+        std::lock_guard<std::mutex> lock(mBrowsersMutex);
+        browsers = mBrowsers;
+    }
+
+    for (size_t i = 0; i < browsers.size(); ++i)
+    {
+        bool still_open;
+        {
+            std::lock_guard<std::mutex> lock(mBrowsersMutex);
+            still_open = std::find(mBrowsers.begin(), mBrowsers.end(), browsers[i]) != mBrowsers.end();
+        }
+
+        if (still_open)
+        {
+            browsers[i]->deliverCallbacks();
+        }
+    }
+}
+
+void dullahan_engine_impl::getUpdateStats(dullahan::dullahan_update_stats& stats)
+{
+    stats = mUpdateStats;
+}
+
+void dullahan_engine_impl::resetUpdateStats()
+{
+    mUpdateStats = dullahan::dullahan_update_stats();
+}
+
+void dullahan_engine_impl::getShutdownStats(dullahan::dullahan_shutdown_stats& stats)
+{
+    stats = mShutdownStats;
+}
+
+// true if CEF asked for work that is due now
+bool dullahan_engine_impl::isPumpWorkDue()
+{
+    std::lock_guard<std::mutex> lock(mPumpMutex);
+
+    return mPumpScheduled && mPumpDeadline <= std::chrono::steady_clock::now();
+}
+
+// CefBrowserProcessHandler override - may be called on any thread
+void dullahan_engine_impl::OnScheduleMessagePumpWork(int64_t delay_ms)
+{
+    schedulePumpWork(std::min(delay_ms, MAX_PUMP_DELAY_MS));
+}
+
+// remember the earliest time update() is needed and arm the timer for it
+void dullahan_engine_impl::schedulePumpWork(int64_t delay_ms)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto deadline = now + std::chrono::milliseconds(std::max(delay_ms, (int64_t)0));
+
+    std::lock_guard<std::mutex> lock(mPumpMutex);
+    if (mPumpScheduled && deadline >= mPumpDeadline)
+    {
+        return;
+    }
+    mPumpScheduled = true;
+    mPumpDeadline = deadline;
+
+#ifdef __linux__
+    if (mPumpTimerFd != -1)
+    {
+        // a time of zero disarms the timer so "now" has to be a tiny bit later
+        const int64_t delay_ns = std::max((int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count(), (int64_t)1);
+
+        struct itimerspec timer = {};
+        timer.it_value.tv_sec = delay_ns / 1000000000;
+        timer.it_value.tv_nsec = delay_ns % 1000000000;
+        timerfd_settime(mPumpTimerFd, 0, &timer, nullptr);
+    }
+#endif
+}
+
+int dullahan_engine_impl::getUpdateDelay()
+{
+    std::lock_guard<std::mutex> lock(mPumpMutex);
+    if (!mInitialized || !mPumpScheduled)
+    {
+        return 0;
+    }
+
+    // round up so sleeping for it never wakes up too early
+    const auto remaining = mPumpDeadline - std::chrono::steady_clock::now();
+    const int64_t delay_ms = (std::chrono::duration_cast<std::chrono::microseconds>(remaining).count() + 999) / 1000;
+
+    return (int)std::max(delay_ms, (int64_t)0);
+}
+
+int dullahan_engine_impl::getUpdateFd()
+{
+    return mPumpTimerFd;
+}
+
+bool dullahan_engine_impl::isMultiThreaded()
+{
+    return mMultiThreaded;
+}
+
+void dullahan_engine_impl::post(std::function<void()> command)
+{
+    if (!mMultiThreaded || CefCurrentlyOn(TID_UI))
+    {
+        command();
+        return;
+    }
+
+    // the first command into an empty queue wakes the UI thread - it runs
+    // everything queued by the time it gets there, in order
+    if (mCommands.push(command))
+    {
+        if (!CefPostTask(TID_UI, new command_task(this)))
+        {
+            // CEF has gone so nothing else will run them - do it here rather
+            // than leave anyone waiting on one forever
+            runCommands();
+        }
+    }
+}
+
+void dullahan_engine_impl::wait(std::function<void()> command)
+{
+    if (!mMultiThreaded || CefCurrentlyOn(TID_UI))
+    {
+        command();
+        return;
+    }
+
+    bool automatically_reset = true;
+    bool initially_signaled = false;
+    CefRefPtr<CefWaitableEvent> event = CefWaitableEvent::CreateWaitableEvent(automatically_reset, initially_signaled);
+
+    post([command, event]()
+    {
+        command();
+        event->Signal();
+    });
+
+    event->Wait();
+}
+
+// called on CEF's UI thread by the task post(..) queued
+void dullahan_engine_impl::runCommands()
+{
+    mCommands.run();
+}
+
+void dullahan_engine_impl::addBrowser(dullahan_impl* browser)
+{
+    std::lock_guard<std::mutex> lock(mBrowsersMutex);
+    if (std::find(mBrowsers.begin(), mBrowsers.end(), browser) == mBrowsers.end())
+    {
+        mBrowsers.push_back(browser);
+    }
+}
+
+void dullahan_engine_impl::removeBrowser(dullahan_impl* browser)
+{
+    std::lock_guard<std::mutex> lock(mBrowsersMutex);
+    mBrowsers.erase(std::remove(mBrowsers.begin(), mBrowsers.end(), browser), mBrowsers.end());
+}
+
+int dullahan_engine_impl::getBrowserCount()
+{
+    std::lock_guard<std::mutex> lock(mBrowsersMutex);
+    return (int)mBrowsers.size();
+}
+
+CefRefPtr<CefRequestContext> dullahan_engine_impl::getRequestContext()
+{
+    return mRequestContext;
+}
+
+// An empty cache path is what keeps a context's cache and cookies in memory
+CefRefPtr<CefRequestContext> dullahan_engine_impl::createEphemeralRequestContext()
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    CefRequestContextSettings settings;
+    settings.persist_session_cookies = false;
+    CefString(&settings.accept_language_list) = mAcceptLanguageList;
+    if (!mCookiesEnabled)
+    {
+        CefString(&settings.cookieable_schemes_list) = "";
+        settings.cookieable_schemes_exclude_defaults = true;
+    }
+
+    return CefRequestContext::CreateContext(settings, nullptr);
+}
+
+void dullahan_engine_impl::setBrowserPoolSize(int size)
+{
+    // update() creates or closes browsers to match
+    mBrowserPoolSize = std::max(size, 0);
+}
+
+bool dullahan_engine_impl::takePooledBrowser(const CefBrowserSettings& browser_settings,
+                                             CefRefPtr<CefRequestContext> request_context,
+                                             CefRefPtr<CefBrowser>& browser,
+                                             CefRefPtr<dullahan_browser_client>& browser_client)
+{
+    if (mBrowserPoolSize == 0)
+    {
+        return false;
+    }
+
+    // anything that changes how the page behaves has to match - the frame rate is set afterwards.
+    // Pooled browsers all use the shared context so one wanting its own never gets one
+    const bool compatible = request_context.get() == mRequestContext.get() &&
+                            browser_settings.javascript == mPoolBrowserSettings.javascript &&
+                            browser_settings.webgl == mPoolBrowserSettings.webgl &&
+                            browser_settings.background_color == mPoolBrowserSettings.background_color &&
+                            browser_settings.image_shrink_standalone_to_fit == mPoolBrowserSettings.image_shrink_standalone_to_fit;
+
+    for (size_t i = 0; compatible && i < mBrowserPool.size(); ++i)
+    {
+        CefRefPtr<CefBrowser> pooled = mBrowserPool[i].client->getBrowser();
+        if (mBrowserPool[i].hidden && !mBrowserPool[i].closing && pooled.get() && pooled->GetHost())
+        {
+            browser = pooled;
+            browser_client = mBrowserPool[i].client;
+            mBrowserPool.erase(mBrowserPool.begin() + i);
+
+            ++mPoolHits;
+            return true;
+        }
+    }
+
+    ++mPoolMisses;
+    return false;
+}
+
+void dullahan_engine_impl::getBrowserPoolStats(int& hits, int& misses, int& ready)
+{
+    hits = mPoolHits;
+    misses = mPoolMisses;
+
+    ready = 0;
+    for (size_t i = 0; i < mBrowserPool.size(); ++i)
+    {
+        if (mBrowserPool[i].hidden && !mBrowserPool[i].closing)
+        {
+            ++ready;
+        }
+    }
+}
+
+// called from update() - hides browsers that have finished being created, closes
+// any the pool no longer has room for and starts one more if it isn't full. Browsers
+// are created asynchronously so this never waits for one
+void dullahan_engine_impl::refillBrowserPool()
+{
+    if (!mReady)
+    {
+        return;
+    }
+
+    // ones we've asked to close stay here until they have - their clients still
+    // point at mPoolParent and tell it when they go
+    int pool_size = 0;
+    for (size_t i = 0; i < mBrowserPool.size(); ++i)
+    {
+        if (!mBrowserPool[i].closing)
+        {
+            ++pool_size;
+        }
+    }
+
+    for (size_t i = mBrowserPool.size(); i > 0; --i)
+    {
+        pooled_browser& entry = mBrowserPool[i - 1];
+        CefRefPtr<CefBrowser> browser = entry.client->getBrowser();
+        if (!browser.get())
+        {
+            if (entry.closing)
+            {
+                mBrowserPool.erase(mBrowserPool.begin() + (i - 1));
+            }
+            continue;
+        }
+
+        if (entry.closing || !browser->GetHost())
+        {
+            continue;
+        }
+
+        if (pool_size > mBrowserPoolSize)
+        {
+            browser->GetHost()->CloseBrowser(true);
+            entry.closing = true;
+            --pool_size;
+        }
+        else if (!entry.hidden)
+        {
+            browser->GetHost()->WasHidden(true);
+            entry.hidden = true;
+        }
+    }
+
+    if (pool_size >= mBrowserPoolSize)
+    {
+        return;
+    }
+
+    if (!mPoolParent.get())
+    {
+        mPoolParent = new dullahan_impl();
+        mPoolParent->setMultiThreaded(mMultiThreaded);
+        mPoolParent->setSize(mPoolWidth, mPoolHeight);
+        mPoolParent->setVisible(false);
+
+        // shared by every browser in the pool - they are hidden so it never copies anything
+        mPoolRenderHandler = new dullahan_render_handler(mPoolParent.get());
+        mPoolRenderHandler->setVisible(false);
+    }
+
+    pooled_browser entry;
+    entry.client = new dullahan_browser_client(mPoolParent.get(), mPoolRenderHandler);
+    entry.hidden = false;
+    entry.closing = false;
+
+    CefWindowInfo window_info;
+    window_info.SetAsWindowless(0);
+    window_info.windowless_rendering_enabled = true;
+    window_info.bounds = { 0, 0, mPoolWidth, mPoolHeight };
+
+    if (CefBrowserHost::CreateBrowser(window_info, entry.client.get(), "about:blank", mPoolBrowserSettings, nullptr, mRequestContext.get()))
+    {
+        mBrowserPool.push_back(entry);
+    }
+}
+
+// CEF won't shut down with browsers open so close the pooled ones and wait for them
+// to go - including any that were still being created. The pool belongs to CEF's UI
+// thread so when that isn't this one each pass is run there
+void dullahan_engine_impl::closeBrowserPool()
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MAX_POOL_CLOSE_MS);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        bool pool_empty = false;
+        wait([this, &pool_empty]()
+        {
+            // stops update() starting new ones while we wait
+            mBrowserPoolSize = 0;
+
+            for (size_t j = mBrowserPool.size(); j > 0; --j)
+            {
+                pooled_browser& entry = mBrowserPool[j - 1];
+                CefRefPtr<CefBrowser> browser = entry.client->getBrowser();
+                if (!browser.get())
+                {
+                    // closed (or not created yet if we haven't asked it to close)
+                    if (entry.closing)
+                    {
+                        mBrowserPool.erase(mBrowserPool.begin() + (j - 1));
+                    }
+                }
+                else if (!entry.closing && browser->GetHost())
+                {
+                    browser->GetHost()->CloseBrowser(true);
+                    entry.closing = true;
+                }
+            }
+
+            pool_empty = mBrowserPool.empty();
+        });
+
+        if (pool_empty)
+        {
+            break;
+        }
+
+        if (!mMultiThreaded)
+        {
+            CefDoMessageLoopWork();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    wait([this]()
+    {
+        // any still open hold a raw pointer to the placeholder parent so it is
+        // kept until the engine goes rather than freed under a late OnBeforeClose
+        if (!mBrowserPool.empty())
+        {
+            DLNOUT("Browser pool still has " << mBrowserPool.size() << " browsers open after " << MAX_POOL_CLOSE_MS << "ms");
+            return;
+        }
+
+        mPoolRenderHandler = nullptr;
+        mPoolParent = nullptr;
+    });
+}
@@ -0,0 +1,198 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef _DULLAHAN_ENGINE_IMPL
+#define _DULLAHAN_ENGINE_IMPL
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cef_app.h"
+
+#include "dullahan.h"
+#include "dullahan_debug.h"
+#include "dullahan_command_queue.h"
+#include "dullahan_profile_pool.h"
+
+class dullahan_impl;
+class dullahan_browser_client;
+class dullahan_render_handler;
+class CefRequestContext;
+class CefWaitableEvent;
+
+// The process wide half of dullahan - CEF itself, the message loop and the
+// request context that every browser (dullahan_impl) created in it shares
+class dullahan_engine_impl :
+    public CefApp,
+    public CefBrowserProcessHandler
+{
+        void platormInitWidevine(std::string cachePath);
+        void platformAddCommandLines(CefRefPtr<CefCommandLine> command_line);
+    public:
+        dullahan_engine_impl();
+        ~dullahan_engine_impl();
+
+        // CefApp overrides
+        virtual void OnBeforeCommandLineProcessing(const CefString& process_type, CefRefPtr<CefCommandLine> command_line) override;
+        CefRefPtr<CefBrowserProcessHandler> GetBrowserProcessHandler() override
+        {
+            return this;
+        }
+
+        // CefBrowserProcessHandler overrides
+        void OnContextInitialized() override;
+        void OnScheduleMessagePumpWork(int64_t delay_ms) override;
+
+        // initAsync(..) returns as soon as CEF has started - browsers can be created once
+        // it says the request context is ready, which update() (or CEF's own thread) gets
+        // to a little later. init(..) does the same but waits for that to happen
+        bool init(dullahan::dullahan_settings& user_settings);
+        bool initAsync(dullahan::dullahan_settings& user_settings);
+        bool waitUntilReady();
+        void shutdown();
+        bool isInitialized();
+        bool isReady();
+
+        void run();
+        void update();
+        dullahan::dullahan_update_result update(int64_t budget_us);
+        void getUpdateStats(dullahan::dullahan_update_stats& stats);
+        void resetUpdateStats();
+        void getShutdownStats(dullahan::dullahan_shutdown_stats& stats);
+
+        // when update() next needs calling - as a delay and on Linux as a timerfd
+        // that becomes readable at that time so the consumer can sleep in poll()
+        int getUpdateDelay();
+        int getUpdateFd();
+
+        // with multi_threaded_message_loop set CEF runs its UI thread itself and work for
+        // it is queued from other threads - run it there (right away when already on it
+        // or CEF shares our thread) and optionally wait for it to finish
+        bool isMultiThreaded();
+        void post(std::function<void()> command);
+        void wait(std::function<void()> command);
+        void runCommands();
+
+        // browsers created in this engine - update() gives each one a turn after CEF's
+        void addBrowser(dullahan_impl* browser);
+        void removeBrowser(dullahan_impl* browser);
+        int getBrowserCount();
+
+        // the context browsers share by default and a new in-memory one for a browser
+        // that wants cache and cookies of its own (it goes when the last reference does)
+        CefRefPtr<CefRequestContext> getRequestContext();
+        CefRefPtr<CefRequestContext> createEphemeralRequestContext();
+
+        // pool of hidden browsers kept ready for new instances - taking one only works
+        // if it was created with the same settings and request context, otherwise it
+        // counts as a miss
+        void setBrowserPoolSize(int size);
+        bool takePooledBrowser(const CefBrowserSettings& browser_settings,
+                               CefRefPtr<CefRequestContext> request_context,
+                               CefRefPtr<CefBrowser>& browser,
+                               CefRefPtr<dullahan_browser_client>& browser_client);
+        void getBrowserPoolStats(int& hits, int& misses, int& ready);
+
+    private:
+        void updateBrowsers();
+        void deliverCallbacks();
+        void refillBrowserPool();
+        void closeBrowserPool();
+        void schedulePumpWork(int64_t delay_ms);
+        bool isPumpWorkDue();
+
+        bool mInitialized;
+        bool mMultiThreaded;
+        std::atomic<bool> mReady;
+
+        // signalled by OnContextInitialized() for waitUntilReady() when CEF runs its own UI thread
+        CefRefPtr<CefWaitableEvent> mReadyEvent;
+
+        // only touched off the UI thread when CEF runs its own - update() hands
+        // callbacks out on the consumer's thread then
+        std::mutex mBrowsersMutex;
+        std::vector<dullahan_impl*> mBrowsers;
+        CefRefPtr<CefRequestContext> mRequestContext;
+
+        // browsers in the pool belong to an instance that has no browser of its own and
+        // no callbacks until they are taken. Each is hidden once it has been created
+        struct pooled_browser
+        {
+            CefRefPtr<dullahan_browser_client> client;
+            bool hidden;
+            bool closing;
+        };
+        std::vector<pooled_browser> mBrowserPool;
+        CefRefPtr<dullahan_impl> mPoolParent;
+        CefRefPtr<dullahan_render_handler> mPoolRenderHandler;
+        CefBrowserSettings mPoolBrowserSettings;
+        int mBrowserPoolSize;
+        int mPoolWidth;
+        int mPoolHeight;
+        int mPoolHits;
+        int mPoolMisses;
+
+        // the earliest time CEF asked to do work - it can ask from any thread
+        std::mutex mPumpMutex;
+        bool mPumpScheduled;
+        std::chrono::steady_clock::time_point mPumpDeadline;
+        int mPumpTimerFd;
+
+        // commands waiting for CEF's UI thread and whether update() already has the
+        // per-browser work queued there
+        dullahan_command_queue mCommands;
+        std::atomic<bool> mBrowserWorkQueued;
+
+        // where root_cache_path came from when the consumer asked for a pooled profile
+        dullahan_profile_pool mProfilePool;
+
+        dullahan::dullahan_update_stats mUpdateStats;
+        dullahan::dullahan_shutdown_stats mShutdownStats;
+
+        std::string mProxyHostPort;
+        bool mSystemFlashEnabled;
+        bool mMediaStreamEnabled;
+        bool mBeginFrameScheduling;
+        bool mForceWaveAudio;
+        bool mDisableGPU;
+        bool mDisableWebSecurity;
+        bool mAllowFileAccessFromFiles;
+        bool mDisableNetworkService;
+        bool mUseMockKeyChain;
+        bool mAutoPlayWithoutGesture;
+        bool mFakeUIForMediaStream;
+        std::string mAcceptLanguageList;
+        bool mCookiesEnabled;
+        int mCacheSizeMB;
+
+        IMPLEMENT_REFCOUNTING(dullahan_engine_impl);
+};
+
+#endif // _DULLAHAN_ENGINE_IMPL
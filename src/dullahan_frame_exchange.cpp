@@ -0,0 +1,178 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#define NOMINMAX
+
+#include "dullahan_frame_exchange.h"
+
+#include "dullahan_pixel_kernels.h"
+
+#include <algorithm>
+
+namespace
+{
+    // set in mMiddle while it holds a frame the consumer hasn't taken yet
+    const unsigned int NEW_FRAME = 0x4;
+    const unsigned int SLOT_MASK = 0x3;
+
+    // beyond this many separate regions we report their bounding box instead
+    const size_t MAX_DAMAGE_RECTS = 8;
+}
+
+dullahan_frame_exchange::dullahan_frame_exchange() :
+    mMiddle(1),
+    mBack(0),
+    mFront(2)
+{
+}
+
+dullahan_frame_exchange::~dullahan_frame_exchange()
+{
+}
+
+size_t dullahan_frame_exchange::getMemoryFootprint()
+{
+    size_t bytes = 0;
+    for (int i = 0; i < NUM_SLOTS; ++i)
+    {
+        bytes += mSlots[i].pixels.capacity();
+    }
+
+    return bytes;
+}
+
+void dullahan_frame_exchange::addRects(std::vector<dullahan::dullahan_rect>& rects,
+                                       const std::vector<dullahan::dullahan_rect>& extra)
+{
+    rects.insert(rects.end(), extra.begin(), extra.end());
+
+    if (rects.size() > MAX_DAMAGE_RECTS)
+    {
+        int left = rects[0].x;
+        int top = rects[0].y;
+        int right = rects[0].x + rects[0].width;
+        int bottom = rects[0].y + rects[0].height;
+        for (size_t i = 1; i < rects.size(); ++i)
+        {
+            left = std::min(left, rects[i].x);
+            top = std::min(top, rects[i].y);
+            right = std::max(right, rects[i].x + rects[i].width);
+            bottom = std::max(bottom, rects[i].y + rects[i].height);
+        }
+
+        rects.resize(1);
+        rects[0].x = left;
+        rects[0].y = top;
+        rects[0].width = right - left;
+        rects[0].height = bottom - top;
+    }
+}
+
+void dullahan_frame_exchange::publish(const unsigned char* pixels, ptrdiff_t stride,
+                                      int width, int height, dullahan::EPixelFormat format,
+                                      uint64_t sequence, const std::vector<dullahan::dullahan_rect>& damage)
+{
+    frame_slot& slot = mSlots[mBack];
+    const int depth = dullahan_pixel_kernels::getPixelDepth(format);
+
+    // a different size or layout means nothing in the slot is any use
+    if (slot.width != width || slot.height != height || slot.format != format)
+    {
+        slot.pixels.resize((size_t)width * height * depth);
+        slot.width = width;
+        slot.height = height;
+        slot.stride = width * depth;
+        slot.format = format;
+
+        dullahan::dullahan_rect everything;
+        everything.width = width;
+        everything.height = height;
+        mStale[mBack].assign(1, everything);
+    }
+
+    // every slot is now behind the page by this frame's damage
+    for (int i = 0; i < NUM_SLOTS; ++i)
+    {
+        addRects(mStale[i], damage);
+    }
+
+    // bring this one up to date - only the parts that changed since it was last filled need copying
+    for (size_t i = 0; i < mStale[mBack].size(); ++i)
+    {
+        const dullahan::dullahan_rect& rect = mStale[mBack][i];
+        const int x = std::max(rect.x, 0);
+        const int y = std::max(rect.y, 0);
+        const int right = std::min(rect.x + rect.width, width);
+        const int bottom = std::min(rect.y + rect.height, height);
+        if (right > x && bottom > y)
+        {
+            dullahan_pixel_kernels::copyRows(slot.pixels.data() + y * slot.stride + x * depth, slot.stride,
+                                             pixels + y * stride + x * depth, stride,
+                                             (right - x) * depth, bottom - y);
+        }
+    }
+    mStale[mBack].clear();
+
+    // the consumer may have skipped frames so report everything since the last one it took
+    addRects(mPendingDamage, damage);
+    slot.damage = mPendingDamage;
+    slot.sequence = sequence;
+
+    // publish it and take back whichever slot was the newest before
+    const unsigned int previous = mMiddle.exchange(mBack | NEW_FRAME, std::memory_order_acq_rel);
+    mBack = previous & SLOT_MASK;
+
+    // if the consumer took the previous frame, the next one only has to cover
+    // what changed since this one. Otherwise the previous frame was dropped and
+    // its damage has to be carried forward
+    if ((previous & NEW_FRAME) == 0)
+    {
+        mPendingDamage = damage;
+    }
+}
+
+bool dullahan_frame_exchange::acquire(dullahan::dullahan_frame& frame)
+{
+    // only the producer sets the flag so if it's there now, it will still be there
+    if ((mMiddle.load(std::memory_order_acquire) & NEW_FRAME) == 0)
+    {
+        return false;
+    }
+
+    const unsigned int previous = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+    mFront = previous & SLOT_MASK;
+
+    const frame_slot& slot = mSlots[mFront];
+    frame.pixels = slot.pixels.data();
+    frame.width = slot.width;
+    frame.height = slot.height;
+    frame.row_pitch = (int)slot.stride;
+    frame.format = slot.format;
+    frame.sequence = slot.sequence;
+    frame.dirty_rects.assign(slot.damage.begin(), slot.damage.end());
+
+    return true;
+}
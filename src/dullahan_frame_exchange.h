@@ -0,0 +1,101 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef _DULLAHAN_FRAME_EXCHANGE
+#define _DULLAHAN_FRAME_EXCHANGE
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dullahan.h"
+#include "dullahan_aligned_buffer.h"
+
+// Hands completed frames from the CEF UI thread to one consumer thread without
+// either of them ever waiting on the other. There are three slots - the producer
+// fills one, the consumer reads another and the third holds the newest finished
+// frame. Ownership moves by swapping slot indices with a single atomic so a slow
+// consumer just misses frames instead of holding up the browser.
+class dullahan_frame_exchange
+{
+    public:
+        dullahan_frame_exchange();
+        ~dullahan_frame_exchange();
+
+        // producer side - CEF UI thread. Copies the regions of pixels that are out of
+        // date in the free slot and makes it the newest frame. damage is the part of
+        // the page that changed since the previous call
+        void publish(const unsigned char* pixels, ptrdiff_t stride,
+                     int width, int height, dullahan::EPixelFormat format,
+                     uint64_t sequence, const std::vector<dullahan::dullahan_rect>& damage);
+
+        // consumer side - any one thread. Swaps the newest frame in if there is one
+        // we haven't seen and returns false otherwise. The pixels stay valid until
+        // the next call
+        bool acquire(dullahan::dullahan_frame& frame);
+
+        // bytes held by the slots - producer thread only
+        size_t getMemoryFootprint();
+
+    private:
+        struct frame_slot
+        {
+            dullahan_aligned_buffer pixels;
+            int width = 0;
+            int height = 0;
+            ptrdiff_t stride = 0;
+            dullahan::EPixelFormat format = dullahan::PF_BGRA;
+            uint64_t sequence = 0;
+
+            // changed since whichever frame the consumer had before this one
+            std::vector<dullahan::dullahan_rect> damage;
+        };
+
+        void addRects(std::vector<dullahan::dullahan_rect>& rects,
+                      const std::vector<dullahan::dullahan_rect>& extra);
+
+        static const int NUM_SLOTS = 3;
+        frame_slot mSlots[NUM_SLOTS];
+
+        // index of the newest finished frame plus a flag set by the producer
+        // when it is published and cleared when the consumer takes it
+        std::atomic<unsigned int> mMiddle;
+
+        // owned by the producer
+        int mBack;
+
+        // parts of each slot that no longer match the page
+        std::vector<dullahan::dullahan_rect> mStale[NUM_SLOTS];
+
+        // damage since the last frame we know the consumer took
+        std::vector<dullahan::dullahan_rect> mPendingDamage;
+
+        // owned by the consumer
+        int mFront;
+};
+
+#endif // _DULLAHAN_FRAME_EXCHANGE
@@ -24,15 +24,15 @@
     THE SOFTWARE.
 */
 
-#ifdef __APPLE__
-#import <Cocoa/Cocoa.h>
-#endif
-
+#define NOMINMAX
 
 #include "dullahan_impl.h"
+#include "dullahan_engine_impl.h"
 #include "dullahan_render_handler.h"
 #include "dullahan_browser_client.h"
 #include "dullahan_callback_manager.h"
+#include "dullahan_frame_exchange.h"
+#include "dullahan_pixel_kernels.h"
 
 #include "include/cef_request_context.h"
 #include "include/cef_request_context_handler.h"
@@ -40,45 +40,85 @@
 #include "include/base/cef_logging.h"
 
 #include "dullahan_version.h"
-#ifdef __APPLE__
-#include "include/wrapper/cef_library_loader.h"
-#endif
-
-
-#ifdef __linux__
-#include "dullahan_impl_linux.cpp"
-#elif WIN32
-#include "dullahan_impl_windows.cpp"
-#include <winnls.h> // for WideCharToMultiByte
-#else
-#include "dullahan_impl_mac.cpp"
-#endif
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <chrono>
-#include <thread>
+
+// tells us when the cookie store has been written - unless we have gone by then
+class dullahan_impl::exit_flush_callback :
+    public CefCompletionCallback
+{
+    public:
+        explicit exit_flush_callback(dullahan_impl* parent) :
+            mParent(parent)
+        {
+        }
+
+        void OnComplete() override
+        {
+            if (mParent)
+            {
+                mParent->onCookiesFlushed();
+            }
+        }
+
+        void detach()
+        {
+            mParent = nullptr;
+        }
+
+    private:
+        dullahan_impl* mParent;
+
+        IMPLEMENT_REFCOUNTING(exit_flush_callback);
+};
 
 dullahan_impl::dullahan_impl() :
-    mInitialized(false),
+    mEngine(nullptr),
+    mOwnsEngine(false),
+    mRequestContextPolicy(dullahan::RCP_PERSISTENT),
+    mMultiThreaded(false),
+    mCallbacksOnUpdateThread(false),
+    mInitPending(false),
+    mInitialWidth(0),
+    mInitialHeight(0),
+    mExitPending(false),
+    mExitCookiesFlushed(false),
+    mExitBrowserClosed(false),
+    mExitTimeoutMs(2000),
+    mSelf(std::make_shared<dullahan_impl*>(this)),
+    mCookieFlushDelayMs(1000),
+    mCookieFlushPending(false),
+    mNextCookieObserverId(1),
+    mHasCookieObservers(false),
+    mHasPendingPixelBuffer(false),
+    mRequestContext(nullptr),
     mBrowser(nullptr),
     mCallbackManager(new dullahan_callback_manager),
+    mFrameExchange(new dullahan_frame_exchange),
+    mInitialized(false),
     mViewWidth(0),
     mViewHeight(0),
-    mSystemFlashEnabled(false),
-    mMediaStreamEnabled(false),
-    mBeginFrameScheduling(false),
-    mForceWaveAudio(false),
-    mDisableGPU(true),
-    mDisableWebSecurity(false),
-    mAllowFileAccessFromFiles(false),
-    mDisableNetworkService(false),
-    mUseMockKeyChain(false),
-    mAutoPlayWithoutGesture(false),
-    mFakeUIForMediaStream(false),
     mFlipPixelsY(false),
+    mZeroCopyFrames(false),
+    mSuppressUnchangedFrames(false),
+    mThreadedFrameExchange(false),
     mFlipMouseY(false),
-    mRequestContext(nullptr),
-    mRequestedPageZoom(1.0)
+    mRequestedPageZoom(1.0),
+    mVisible(true),
+    mFrameRate(60),
+    mAdaptiveFrameRate(false),
+    mIdleFrameRate(5),
+    mIdlePaintCount(30),
+    mQuietPaints(0),
+    mFrameRateIdle(false),
+    mLifecycleState(dullahan::LS_ACTIVE),
+    mThrottledFrameRate(10),
+    mDiscardPending(false),
+    mPixelFormat(dullahan::PF_BGRA),
+    mPixelDepth(4)
 {
     DLNOUT("dullahan_impl::dullahan_impl()");
 }
@@ -86,472 +126,782 @@ dullahan_impl::dullahan_impl() :
 dullahan_impl::~dullahan_impl()
 {
     DLNOUT("dullahan_impl::~dullahan_impl()");
+    *mSelf = nullptr;
+    if (mExitFlushCallback.get())
+    {
+        mExitFlushCallback->detach();
+    }
+    if (mBrowserClient.get())
+    {
+        mBrowserClient->detachParent();
+    }
+    if (mEngine.get())
+    {
+        mEngine->removeBrowser(this);
+    }
     delete mCallbackManager;
     mCallbackManager = nullptr;
+    delete mFrameExchange;
+    mFrameExchange = nullptr;
 }
 
-void dullahan_impl::OnBeforeCommandLineProcessing(const CefString& process_type,
-        CefRefPtr<CefCommandLine> command_line)
+bool dullahan_impl::init(dullahan::dullahan_settings& user_settings)
 {
-    if (process_type.empty())
+    DLNOUT("dullahan_impl::init()");
+
+    // no engine to share so this browser gets one of its own
+    CefRefPtr<dullahan_engine_impl> engine = new dullahan_engine_impl();
+    if (!engine->init(user_settings))
     {
-        // <ND> Enable HTMLImports to get youtube live chat to work
-        command_line->AppendSwitchWithValue("enable-blink-features", "HTMLImports");
-        if (mMediaStreamEnabled == true)
-        {
-            command_line->AppendSwitch("enable-media-stream");
-        }
+        return false;
+    }
+    mOwnsEngine = true;
+
+    return init(engine, user_settings);
+}
+
+bool dullahan_impl::init(CefRefPtr<dullahan_engine_impl> engine, dullahan::dullahan_settings& user_settings)
+{
+    DLNOUT("dullahan_impl::init() with engine");
+
+    if (!initAsync(engine, user_settings) || !mEngine->waitUntilReady())
+    {
+        return false;
+    }
+
+    // onEngineReady() is either running on CEF's thread or queued for it -
+    // anything we queue after it only runs once it is done
+    mEngine->wait([]()
+    {
+    });
+
+    return true;
+}
+
+bool dullahan_impl::initAsync(dullahan::dullahan_settings& user_settings)
+{
+    DLNOUT("dullahan_impl::initAsync()");
+
+    CefRefPtr<dullahan_engine_impl> engine = new dullahan_engine_impl();
+    if (!engine->initAsync(user_settings))
+    {
+        return false;
+    }
+    mOwnsEngine = true;
+
+    return initAsync(engine, user_settings);
+}
+
+bool dullahan_impl::initAsync(CefRefPtr<dullahan_engine_impl> engine, dullahan::dullahan_settings& user_settings)
+{
+    DLNOUT("dullahan_impl::initAsync() with engine");
+
+    if (!engine.get() || !engine->isInitialized())
+    {
+        return false;
+    }
+    mEngine = engine;
+    mMultiThreaded = mEngine->isMultiThreaded();
+
+    // if true, this setting inverts the pixels in Y direction - useful if your texture
+    // coords are upside down compared to default for Dullahan
+    mFlipPixelsY = user_settings.flip_pixels_y;
+
+    // the layout of pixels we hand to the consumer - CEF always gives us BGRA
+    // so anything else is converted as the pixels are copied out of CEF
+    mPixelFormat = user_settings.output_pixel_format;
+    mPixelDepth = dullahan_pixel_kernels::getPixelDepth(mPixelFormat);
+
+    // if true, paint callbacks are handed CEF's own buffer when we don't need to flip
+    // or composite a popup into it, saving a copy of the page for every paint
+    mZeroCopyFrames = user_settings.zero_copy_frames;
+
+    // if true, paints that leave the page looking the same (blinking carets that are
+    // hidden, animations that are off screen etc.) are not passed on to the consumer
+    mSuppressUnchangedFrames = user_settings.suppress_unchanged_frames;
+
+    // if true, every frame is also copied into a triple buffer that another
+    // thread can pull the latest one from with acquireLatestFrame()
+    mThreadedFrameExchange = user_settings.threaded_frame_exchange;
+
+    // if true (and CEF runs its own UI thread), callbacks that don't answer CEF are made
+    // from update() - the page changed ones from frames taken out of the frame exchange
+    mCallbacksOnUpdateThread = mMultiThreaded && user_settings.callbacks_on_update_thread;
+    if (mCallbacksOnUpdateThread)
+    {
+        mThreadedFrameExchange = true;
+        mCallbackManager->setDeferred(true);
+    }
+
+    // if true, this setting inverts the injected mouse coordinates in Y direction
+    // useful for matching the setting for flipPixelsY
+    mFlipMouseY = user_settings.flip_mouse_y;
+
+    // CEF clamps it to this range anyway - and the idle timeout divides by it
+    mFrameRate = std::max(1, std::min(user_settings.frame_rate, 60));
+
+    // if true, pages that aren't changing are painted at a much lower rate
+    mAdaptiveFrameRate = user_settings.adaptive_frame_rate;
+    mIdleFrameRate = std::max(1, std::min(user_settings.idle_frame_rate, mFrameRate));
+    mIdlePaintCount = std::max(user_settings.idle_paint_count, 1);
+    mLastBusyTime = std::chrono::steady_clock::now();
+
+    // longest requestExit() waits before telling the consumer anyway
+    mExitTimeoutMs = std::max(user_settings.exit_timeout_ms, 0);
+
+    // shared, on disk cache and cookies or ones of our own in memory
+    mRequestContextPolicy = user_settings.request_context_policy;
 
-        if (mSystemFlashEnabled == true)
+    // how long cookies that have been set wait to be written to disk
+    mCookieFlushDelayMs = std::max(user_settings.cookie_flush_delay_ms, 0);
+
+    // cap on the frame rate while in the throttled lifecycle state
+    mThrottledFrameRate = std::max(1, std::min(user_settings.throttled_frame_rate, 60));
+
+    // kept so a discarded browser can be created again with the same settings
+    makeBrowserSettings(user_settings, mBrowserSettings);
+    mBrowserSettings.windowless_frame_rate = fullFrameRate();
+
+    mInitialWidth = user_settings.initial_width;
+    mInitialHeight = user_settings.initial_height;
+
+    {
+        std::lock_guard<std::mutex> lock(mPendingMutex);
+        mInitPending = true;
+    }
+
+    // the engine calls onEngineReady() when it is ready - if it already
+    // is, it won't so we queue it ourselves (a second call does nothing)
+    mEngine->addBrowser(this);
+    if (mEngine->isReady())
+    {
+        mEngine->post([this]()
         {
-            command_line->AppendSwitch("enable-system-flash");
-        }
+            onEngineReady();
+        });
+    }
 
-        if (mBeginFrameScheduling == true)
+    return true;
+}
+
+// the rest of initialization - on CEF's UI thread once the request context
+// the browser needs is ready
+void dullahan_impl::onEngineReady()
+{
+    {
+        std::lock_guard<std::mutex> lock(mPendingMutex);
+        if (!mInitPending)
         {
-            command_line->AppendSwitch("enable-begin-frame-scheduling");
+            return;
         }
+    }
+
+    mRenderHandler = new dullahan_render_handler(this);
+    mBrowserClient = new dullahan_browser_client(this, mRenderHandler);
+
+    // consumer may have said nobody can see it before we got this far
+    if (!mVisible)
+    {
+        mRenderHandler->setVisible(false);
+    }
+
+    if (mHasPendingPixelBuffer)
+    {
+        mRenderHandler->setExternalBuffer(mPendingPixelBuffer);
+        mHasPendingPixelBuffer = false;
+    }
+
+    // cookies, cache etc. are shared by all the browsers in the engine - unless this
+    // one is ephemeral, when it gets its own in memory that goes away along with it
+    if (mRequestContextPolicy == dullahan::RCP_EPHEMERAL)
+    {
+        mRequestContext = mEngine->createEphemeralRequestContext();
+    }
+    else
+    {
+        mRequestContext = mEngine->getRequestContext();
+    }
+
+    // browser for this instance - empty URL
+    createBrowser(std::string(), mInitialWidth, mInitialHeight);
+
+    // important: set the size *after* we create a browser
+    setSize(mInitialWidth, mInitialHeight);
+
+    // recent versions of CEF seem to be pickier (rightly so) about calling dullahan_impl::update()
+    // before initialization has completed so we should block that until we're fully complete here
+    mInitialized = true;
+
+    // consumer may have picked a lifecycle state before there was a browser to apply it to
+    if (mLifecycleState != dullahan::LS_ACTIVE)
+    {
+        const dullahan::ELifecycleState state = mLifecycleState;
+        mLifecycleState = dullahan::LS_ACTIVE;
+        setLifecycleState(state);
+    }
 
-        // The ability to access local files used to be a member of CefBrowserSettings but
-        // now is is configured globally via command line switch (https://github.com/cefsharp/CefSharp/issues/3668)
-        if (mAllowFileAccessFromFiles == true)
+    // calls made while we were waiting, in the order they were made - anything
+    // posted from now on goes straight to CEF's thread so it comes after these
+    std::vector<std::function<void()>> commands;
+    {
+        std::lock_guard<std::mutex> lock(mPendingMutex);
+        mInitPending = false;
+        commands.swap(mPendingCommands);
+    }
+
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        commands[i]();
+    }
+
+    mCallbackManager->onReady(mBrowser.get() != nullptr);
+}
+
+void dullahan_impl::makeBrowserSettings(const dullahan::dullahan_settings& user_settings, CefBrowserSettings& browser_settings)
+{
+    browser_settings.windowless_frame_rate = user_settings.frame_rate;
+    browser_settings.webgl = user_settings.webgl_enabled ? STATE_ENABLED : STATE_DISABLED;
+    browser_settings.javascript = user_settings.javascript_enabled ? STATE_ENABLED : STATE_DISABLED;
+    browser_settings.background_color = user_settings.background_color;
+    browser_settings.image_shrink_standalone_to_fit = user_settings.image_shrink_standalone_to_fit ? STATE_ENABLED : STATE_DISABLED;
+}
+
+// create the browser with our settings, client and request context - no extra_info
+bool dullahan_impl::createBrowser(const std::string url, int width, int height)
+{
+    // take one the engine started earlier if we can - it's hidden and showing about:blank
+    // so it just needs pointing at us and the page, skipping the wait for a new renderer
+    CefRefPtr<CefBrowser> pooled_browser;
+    CefRefPtr<dullahan_browser_client> pooled_client;
+    if (mEngine->takePooledBrowser(mBrowserSettings, mRequestContext, pooled_browser, pooled_client))
+    {
+        DLNOUT("Using browser from the pool for " << url);
+
+        // a discarded browser can still be closing in the old client - it mustn't
+        // look like ours closing when it gets there
+        if (mBrowserClient.get() && mBrowserClient != pooled_client)
         {
-            command_line->AppendSwitch("allow-file-access-from-files");
+            mBrowserClient->detachParent();
         }
 
-        // <ND> n.b. be careful enabling this. At least on Linux it will break sites like twitch.tv mixer.com, dlive.com.
-        // Probably this also makes only sense for Win32?
+        mBrowser = pooled_browser;
+        mBrowserClient = pooled_client;
+        mBrowserClient->setParent(this, mRenderHandler);
 
-        if (mDisableGPU == true)
+        mViewWidth = width;
+        mViewHeight = height;
+        mBrowser->GetHost()->SetWindowlessFrameRate(mBrowserSettings.windowless_frame_rate);
+        mBrowser->GetHost()->WasResized();
+        if (isRendering())
         {
-            command_line->AppendSwitch("disable-gpu");
-            command_line->AppendSwitch("disable-gpu-compositing");
+            mBrowser->GetHost()->WasHidden(false);
+            mBrowser->GetHost()->Invalidate(PET_VIEW);
         }
 
-        if (mDisableWebSecurity)
+        if (!url.empty() && mBrowser->GetMainFrame())
         {
-            command_line->AppendSwitch("disable-web-security");
+            mBrowser->GetMainFrame()->LoadURL(url);
         }
 
-        if (mDisableNetworkService)
+        return true;
+    }
+
+    // Windowspecific settings for OSR
+    CefWindowInfo window_info;
+    window_info.SetAsWindowless(0);
+    window_info.windowless_rendering_enabled = true;
+    window_info.bounds = { 0, 0, width, height };
+
+    mBrowser = CefBrowserHost::CreateBrowserSync(window_info, mBrowserClient.get(), url, mBrowserSettings, nullptr, mRequestContext.get());
+    if (!mBrowser.get() || !mBrowser->GetHost())
+    {
+        DLNOUT("Unable to create browser for " << url);
+        mBrowser = nullptr;
+        return false;
+    }
+
+    // browsers start off visible
+    if (!isRendering())
+    {
+        mBrowser->GetHost()->WasHidden(true);
+    }
+
+    return true;
+}
+
+void dullahan_impl::shutdown()
+{
+    // a browser that is still waiting for the engine is never created
+    {
+        std::lock_guard<std::mutex> lock(mPendingMutex);
+        mInitPending = false;
+        mPendingCommands.clear();
+    }
+
+    // on CEF's UI thread - anything queued for it before this has run by the time it returns
+    wait([this]()
+    {
+        mInitialized = false;
+        mExitPending = false;
+        if (mExitFlushCallback.get())
         {
-            command_line->AppendSwitchWithValue("disable-features", "NetworkService");
+            mExitFlushCallback->detach();
+            mExitFlushCallback = nullptr;
         }
 
-        if (mUseMockKeyChain)
+        // cookies waiting to be written aren't left behind - and
+        // callbacks for cookie calls still in CEF's hands go nowhere
+        if (mCookieFlushPending)
         {
-            command_line->AppendSwitch("use-mock-keychain");
+            flushCookies(nullptr);
         }
+        *mSelf = nullptr;
+        mSelf = std::make_shared<dullahan_impl*>(this);
 
-        if (mAutoPlayWithoutGesture)
+        mBrowser = nullptr;
+        mRenderHandler = nullptr;
+        if (mBrowserClient.get())
         {
-            command_line->AppendSwitchWithValue("autoplay-policy", "no-user-gesture-required");
+            mBrowserClient->detachParent();
         }
+        mBrowserClient = nullptr;
+        mRequestContext = nullptr;
 
-        if (mFakeUIForMediaStream)
+        if (mEngine.get())
         {
-            command_line->AppendSwitch("use-fake-ui-for-media-stream");
+            mEngine->removeBrowser(this);
         }
+    });
 
-        if (mProxyHostPort.length())
+    if (mEngine.get())
+    {
+        // CEF only goes away with us if nobody else is using it
+        if (mOwnsEngine)
         {
-            command_line->AppendSwitchWithValue("--proxy-server", mProxyHostPort);
+            mEngine->shutdown();
+
+            dullahan::dullahan_shutdown_stats engine_stats;
+            mEngine->getShutdownStats(engine_stats);
+            mShutdownStats.pool_close_us = engine_stats.pool_close_us;
+            mShutdownStats.cef_shutdown_us = engine_stats.cef_shutdown_us;
         }
+        mEngine = nullptr;
+        mOwnsEngine = false;
+    }
+}
 
-        // Hardcode the switch to turn off the HTTP Basic Auth dialogs
-        // as per this issue: https://github.com/chromiumembedded/cef/issues/3603
-        // Having these dialogs appear with new (139) version of the CEF is
-        // regarded as a griefing vector - easy to create a prim with media
-        // that spams these dialogs / taskbar icons to the user.
-        // This change lets us intercept the auth request as before and deal with
-        // it using native Viewer UI as before.
-        // Details captured in this GHI: https://github.com/secondlife/viewer-private/issues/489
-        command_line->AppendSwitch("disable-chrome-login-prompt");
+// Start writing cookies and closing the browser at the same time - onRequestExit is
+// called once both are done (see checkExit()) or exit_timeout_ms has gone by
+void dullahan_impl::requestExit()
+{
+    // already on its way out
+    if (mExitPending)
+    {
+        return;
+    }
 
-        platformAddCommandLines(command_line);
+    const bool have_browser = mBrowser.get() && mBrowser->GetHost();
+    if (!have_browser && mLifecycleState != dullahan::LS_DISCARDED)
+    {
+        return;
     }
-}
 
-#ifdef WIN32
-// copied from viewer's llstring.h
-std::string convert_wide_to_string(const wchar_t* in, unsigned int code_page)
-{
-    std::string out;
-    if (in)
-    {
-        int len_in = (int)wcslen(in);
-        int len_out = WideCharToMultiByte(
-            code_page,
-            0,
-            in,
-            len_in,
-            NULL,
-            0,
-            0,
-            0);
-        // We will need two more bytes for the double NULL ending
-        // created in WideCharToMultiByte().
-        char* pout = new char[len_out + 2];
-        memset(pout, 0, len_out + 2);
-        if (pout)
-        {
-            WideCharToMultiByte(
-                code_page,
-                0,
-                in,
-                len_in,
-                pout,
-                len_out,
-                0,
-                0);
-            out.assign(pout);
-            delete[] pout;
-        }
+    mExitPending = true;
+    mExitCookiesFlushed = false;
+    mExitBrowserClosed = false;
+    mExitStart = std::chrono::steady_clock::now();
+    mShutdownStats = dullahan::dullahan_shutdown_stats();
+
+    // this write covers any cookies that were waiting for one
+    mCookieFlushPending = false;
+
+    CefRefPtr<CefCookieManager> manager = getCookieManager();
+    mExitFlushCallback = new exit_flush_callback(this);
+    if (!manager || !manager->FlushStore(mExitFlushCallback.get()))
+    {
+        // nothing to write
+        mExitFlushCallback = nullptr;
+        mExitCookiesFlushed = true;
+    }
+
+    if (have_browser)
+    {
+        bool force_close = false;
+
+        mBrowser->GetHost()->CloseBrowser(force_close);
+    }
+    else if (mDiscardPending)
+    {
+        // no browser to close but the discarded one is still on its way
+        // out - OnBeforeClose(..) counts it as the exit now
+        mDiscardPending = false;
     }
-    return out;
+    else
+    {
+        mExitBrowserClosed = true;
+    }
+
+    checkExit();
 }
-#endif
 
-bool dullahan_impl::initCEF(dullahan::dullahan_settings& user_settings)
+void dullahan_impl::onCookiesFlushed()
 {
-#ifdef WIN32
-    CefMainArgs args(GetModuleHandle(nullptr));
-#elif __APPLE__
-    CefScopedLibraryLoader library_loader;
-    if (!library_loader.LoadInMain())
+    if (!mExitPending || mExitCookiesFlushed)
     {
-        return false;
+        return;
     }
 
-    CefMainArgs args(0, nullptr);
-#endif
-#ifdef __linux__
-    CefMainArgs args(0, nullptr);
-#endif
+    mExitCookiesFlushed = true;
+    mExitFlushCallback = nullptr;
+    mShutdownStats.cookie_flush_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mExitStart).count();
 
-    CefSettings settings;
+    checkExit();
+}
 
-    // point to host application helper
-#ifdef WIN32
-    // Note: as of CEF 83, it appears that on Windows builds, the path to the host
-    // helper application must be an absolute path vs the existing, relative path.
-    // If the user has not specified a path to the helper explicitly, then we can,
-    // as a first pass, assume it's located next to the executable (it often is)
-    // and for use cases where it is located elsewhere, the consumer can specify
-    // the absolute path directly.
-    std::string host_process_path = user_settings.host_process_path;
-    if (host_process_path.empty())
-    {
-        // path is not specified so assume it's adjacent to the executable
-        std::vector<wchar_t> exe_path(MAX_PATH + 1);
-        GetModuleFileNameW(NULL, &exe_path[0], MAX_PATH);
-        std::string cur_exe_path = convert_wide_to_string(&exe_path[0], CP_UTF8);
-        const size_t last_slash_idx = cur_exe_path.find_last_of("\\/");
-        if (last_slash_idx == std::string::npos)
-        {
-            return false;
-        }
-        host_process_path = cur_exe_path.erase(last_slash_idx + 1);
+// the last of our browsers has closed (and not because it was discarded)
+void dullahan_impl::onBrowserClosed()
+{
+    // already counted - or given up on when exit timed out
+    if (mExitBrowserClosed)
+    {
+        return;
     }
 
-    // finally, tell CEF where to find the host process helper
-    CefString(&settings.browser_subprocess_path) = host_process_path + "\\" + user_settings.host_process_filename;
+    // closed by the page itself so there's nothing else to wait for
+    if (!mExitPending)
+    {
+        mCallbackManager->onRequestExit();
+        return;
+    }
 
-    settings.no_sandbox = true;
-#elif __APPLE__
-    NSString* appBundlePath = [[NSBundle mainBundle] bundlePath];
-    CefString(&settings.browser_subprocess_path) =
-        [[NSString stringWithFormat:
-          @"%@/Contents/Frameworks/DullahanHelper.app/Contents/MacOS/DullahanHelper", appBundlePath] UTF8String];
-
-    CefString(&settings.framework_dir_path) =
-    [[NSString stringWithFormat:
-      @"%@/Contents/Frameworks/Chromium Embedded Framework.framework", appBundlePath] UTF8String];
-
-	settings.no_sandbox = true;
-#elif __linux__
-    CefString(&settings.browser_subprocess_path) = getExeCwd() + "/dullahan_host";
-    bool useSandbox = false;
-    std::string sandboxName = getExeCwd() + "/chrome-sandbox";
-    struct stat st;
-
-    if (!stat(sandboxName.c_str(), &st))
-    {
-        // Sandbox must be owned by root:root and has the suid bit set, otherwise cef won't use it.
-        if (st.st_uid == 0 && st.st_gid == 0 && (st.st_mode & S_ISUID) == S_ISUID)
-        {
-            useSandbox = true;
-        }
+    mExitBrowserClosed = true;
+    mShutdownStats.browser_close_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mExitStart).count();
+
+    checkExit();
+}
+
+void dullahan_impl::checkExit()
+{
+    if (mExitPending && mExitCookiesFlushed && mExitBrowserClosed)
+    {
+        finishExit(false);
     }
+}
 
-    settings.no_sandbox = !useSandbox;
-#else
-#error "Unsupported Platform"
-#endif
-    // required for CEF 72+ to indicate headless
-    settings.windowless_rendering_enabled = true;
+void dullahan_impl::finishExit(bool timed_out)
+{
+    mExitPending = false;
+    mShutdownStats.timed_out = timed_out;
+    mShutdownStats.exit_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mExitStart).count();
 
-    // CEF header file suggest that we need this now
-    settings.external_message_pump = true;
+    DLNOUT("Exit took " << mShutdownStats.exit_us << "us - cookies " << mShutdownStats.cookie_flush_us
+           << "us, browser " << mShutdownStats.browser_close_us << "us" << (timed_out ? " (timed out)" : ""));
 
-    // use a single thread for the message loop
-    settings.multi_threaded_message_loop = false;
+    mCallbackManager->onRequestExit();
+}
 
-    // act like a browser and do not persist session cookies ever
-    settings.persist_session_cookies = user_settings.cookies_enabled;
+void dullahan_impl::getShutdownStats(dullahan::dullahan_shutdown_stats& stats)
+{
+    stats = mShutdownStats;
+}
 
-    // explicitly set the path to the locales folder since defaults no longer work on some systems
-    CefString(&settings.locales_dir_path) = user_settings.locales_dir_path;
+void dullahan_impl::getSize(int& width, int& height)
+{
+    width = mViewWidth;
+    height = mViewHeight;
+}
 
-    // set path to root cache if enabled and set
-    CefString(&settings.root_cache_path) = user_settings.root_cache_path;
-#ifdef WIN32
-    CefString(&settings.cache_path) = user_settings.root_cache_path + "\\" + "cache";
-#else
-    CefString(&settings.cache_path) = user_settings.root_cache_path + "/" + "cache";
-#endif
+void dullahan_impl::setSize(int width, int height)
+{
+    DLNOUT("dullahan_impl::setSize() << width << " << width << " x " << height);
 
-    // as of CEF 90, the new way to disable cookies
-    if (user_settings.cookies_enabled == false)
-    {
-        CefString(&settings.cookieable_schemes_list) = "";
-        settings.cookieable_schemes_exclude_defaults = true;
-    }
+    // kept even without a browser - one created later (or brought back after
+    // being discarded) starts out at this size
+    mViewWidth = width;
+    mViewHeight = height;
 
-    // insert a new string into user agent
-    if (user_settings.user_agent_substring.length())
+    if (mBrowser.get() && mBrowser->GetHost())
     {
-        std::string user_agent(user_settings.user_agent_substring);
-        cef_string_utf8_to_utf16(user_agent.c_str(), user_agent.size(), &settings.user_agent_product);
+        mBrowser->GetHost()->WasResized();
     }
-    else
+}
+
+void dullahan_impl::setPixelBuffer(const dullahan::dullahan_pixel_buffer& buffer)
+{
+    // handed over once there is a render handler to take it
+    if (!mRenderHandler.get())
     {
-        std::string user_agent = makeCompatibleUserAgentString("");
-        cef_string_utf8_to_utf16(user_agent.c_str(), user_agent.size(), &settings.user_agent_product);
+        mPendingPixelBuffer = buffer;
+        mHasPendingPixelBuffer = true;
+        return;
     }
 
-    // the proxy host:port to use
-    mProxyHostPort = user_settings.proxy_host_port;
+    mRenderHandler->setExternalBuffer(buffer);
 
-    // list of language locale codes used to configure the Accept-Language HTTP header value
-    if (user_settings.accept_language_list.length())
+    // the new buffer is empty so ask for the whole page even if nothing changed
+    if (mBrowser.get() && mBrowser->GetHost())
     {
-        std::string accept_language_list(user_settings.accept_language_list);
-        cef_string_utf8_to_utf16(accept_language_list.c_str(),
-                                 accept_language_list.size(), &settings.accept_language_list);
+        mBrowser->GetHost()->Invalidate(PET_VIEW);
     }
+}
 
-    // enable/disable use of system Flash
-    mSystemFlashEnabled = user_settings.plugins_enabled & user_settings.flash_enabled;
+bool dullahan_impl::acquireLatestFrame(dullahan::dullahan_frame& frame)
+{
+    if (!mThreadedFrameExchange)
+    {
+        return false;
+    }
 
-    // enable/disable media stream (web cams etc.)
-    // IMPORTANT: there is no "Use Your WebCam OK?" dialog so enable this at your peril
-    mMediaStreamEnabled = user_settings.media_stream_enabled;
+    return mFrameExchange->acquire(frame);
+}
 
-    // this flag needed for some video cards to force onPaints to work - off by default
-    mBeginFrameScheduling = user_settings.begin_frame_scheduling;
+bool dullahan_impl::acquireFrame(uint64_t last_sequence, dullahan::dullahan_frame& frame)
+{
+    if (mRenderHandler.get())
+    {
+        return mRenderHandler->acquireFrame(last_sequence, frame);
+    }
 
-#ifdef WIN32
-    // this flag forces Windows WaveOut/In audio API even if Core Audio is supported
-    mForceWaveAudio = user_settings.force_wave_audio;
-#endif
+    return false;
+}
 
-    // this flag if set, adds command line options to disable the GPU and GPU compositing.
-    // Appears to be needed to make sites like Google Maps work now. The GPU compositing
-    // needs to be off to allow videos to play back without stutter. For the moment, it is
-    // recommended that this option always be enabled.
-    mDisableGPU = user_settings.disable_gpu;
-
-    // this flag if set, adds command line parameters to disable the web security component
-    // that prohibits you from browsing local files.  It is used in the 360 Capture feature
-    // in the viewer to open a web page that references locally generated images without
-    // needing a web server.
-    mDisableWebSecurity = user_settings.disable_web_security;
-
-    // this flag allows access to local files - it used to be set via a member of CefBrowserSettings
-    // but now must be set via the command line so we capture it here
-    mAllowFileAccessFromFiles = user_settings.file_access_from_file_urls;
-
-    // this flag if set, adds a command line parameter that disables "network service" and
-    // is like adding --disable-features=NetworkService. This appears to be required after
-    // Chrome 75 to disable the "Chrome wants access to passwords" dialog on macOS that
-    // started to appear. May change later.
-    mDisableNetworkService = user_settings.disable_network_service;
-
-    // this flag if set, adds a command line parameter that replaces disable_network_service
-    // flag to bypass the dialog on macOS that appears in Chrome 79+ to disable the
-    // "Chrome wants access to passwords" dialog on macOS that started to appear.
-    mUseMockKeyChain = user_settings.use_mock_keychain;
-
-    // this flag, if set, allows video/audio to autoplay if the URL parameters are configured
-    // correctly to do so. (by default as of Chrome 70, audio/video does not autoplay)
-    mAutoPlayWithoutGesture = user_settings.autoplay_without_gesture;
-
-    // this flag, if set allows you to bypass UI like "This page wants to use
-    // your microphone" and accept the request. Obviously, use with caution -
-    // eventually, this will be implemented as a callback so the consumer can
-    // provide their own ("Allow, "Disallow") UI.
-    mFakeUIForMediaStream = user_settings.fake_ui_for_media_stream;
+size_t dullahan_impl::getPixelMemoryFootprint()
+{
+    size_t bytes = mFrameExchange->getMemoryFootprint();
+    if (mRenderHandler.get())
+    {
+        bytes += mRenderHandler->getMemoryFootprint();
+    }
 
-    // if true, this setting inverts the pixels in Y direction - useful if your texture
-    // coords are upside down compared to default for Dullahan
-    mFlipPixelsY = user_settings.flip_pixels_y;
+    return bytes;
+}
 
-    // if true, this setting inverts the injected mouse coordinates in Y direction
-    // useful for matching the setting for flipPixelsY
-    mFlipMouseY = user_settings.flip_mouse_y;
+int dullahan_impl::getDepth()
+{
+    return mPixelDepth;
+}
 
-    // log file settings
-    CefString(&settings.log_file) = user_settings.log_file;
-    settings.log_severity = user_settings.log_verbose ? LOGSEVERITY_VERBOSE : LOGSEVERITY_DEFAULT;
+int dullahan_impl::getViewDepth()
+{
+    return mViewDepth;
+}
 
-	if (user_settings.enable_remote_debug)
-	{
-		// allow Chrome (or other CEF windoW) to debug at http://localhost::PORT_NUMBER
-		settings.remote_debugging_port = user_settings.remote_debugging_port;
-	}
+dullahan::EPixelFormat dullahan_impl::getPixelFormat()
+{
+    return mPixelFormat;
+}
 
-    // initiaize CEF
-    bool result = CefInitialize(args, settings, this, nullptr);
-    return result;
+bool dullahan_impl::getFlipPixelsY()
+{
+    return mFlipPixelsY;
 }
 
+bool dullahan_impl::getZeroCopyFrames()
+{
+    return mZeroCopyFrames;
+}
 
+bool dullahan_impl::getSuppressUnchangedFrames()
+{
+    return mSuppressUnchangedFrames;
+}
 
-bool dullahan_impl::init(dullahan::dullahan_settings& user_settings)
+dullahan_frame_exchange* dullahan_impl::getFrameExchange()
 {
-    DLNOUT("dullahan_impl::init()");
+    return mThreadedFrameExchange ? mFrameExchange : nullptr;
+}
 
-    platormInitWidevine(user_settings.root_cache_path);
+bool dullahan_impl::getFlipMouseY()
+{
+    return mFlipMouseY;
+}
 
-    if (!initCEF(user_settings))
+void dullahan_impl::run()
+{
+    if (mEngine.get())
     {
-        return false;
+        mEngine->run();
     }
+}
 
-    CefBrowserSettings browser_settings;
-    browser_settings.windowless_frame_rate = user_settings.frame_rate;
-    browser_settings.webgl = user_settings.webgl_enabled ? STATE_ENABLED : STATE_DISABLED;
-    browser_settings.javascript = user_settings.javascript_enabled ? STATE_ENABLED : STATE_DISABLED;
-    browser_settings.background_color = user_settings.background_color;
-    browser_settings.image_shrink_standalone_to_fit = user_settings.image_shrink_standalone_to_fit ? STATE_ENABLED : STATE_DISABLED;
+void dullahan_impl::update()
+{
+    // an engine of our own only has us in it so updating it does our work too - a
+    // shared one is updated by the consumer so we just do the work for this browser
+    if (mOwnsEngine)
+    {
+        mEngine->update();
+    }
+    else
+    {
+        post([this]()
+        {
+            updateBrowser();
+        });
+        deliverCallbacks();
+    }
+}
 
-    mRenderHandler = new dullahan_render_handler(this);
-    mBrowserClient = new dullahan_browser_client(this, mRenderHandler);
+dullahan::dullahan_update_result dullahan_impl::update(int64_t budget_us)
+{
+    if (mOwnsEngine)
+    {
+        return mEngine->update(budget_us);
+    }
 
-    // Windowspecific settings for OSR
-    CefWindowInfo window_info;
-    window_info.SetAsWindowless(0);
-    window_info.windowless_rendering_enabled = true;
-    const int width = user_settings.initial_width;
-    const int height = user_settings.initial_height;
-    window_info.bounds = { 0, 0, width, height };
+    post([this]()
+    {
+        updateBrowser();
+    });
+    deliverCallbacks();
 
-    mRequestContext = CefRequestContext::GetGlobalContext();
+    return dullahan::dullahan_update_result();
+}
 
-    // Generate a short pause between creating the request context and creating
-    // the browser. This is not a good solution but for the moment, seems to
-    // work - I can repro the error 1 in 5 times.  I've tried this hundreds of
-    // times and haven't seen it. Probably hardware specific. Probably appear
-    // for me as soon as this ships! The correct solution is likely to be
-    // hooking up the callback in the second parameter of CreateContext and
-    // overriding the OnRequestContextINitialized() virtual override. Then,
-    // once that fires, continue with the rest of initialization.
-    const int num_extra_cef_work_loops = 10;
-    const int sleep_time_between_calls = 5;
-    for (int i = 0; i < num_extra_cef_work_loops; ++i)
+void dullahan_impl::getUpdateStats(dullahan::dullahan_update_stats& stats)
+{
+    if (mEngine.get())
+    {
+        mEngine->getUpdateStats(stats);
+    }
+    else
     {
-        CefDoMessageLoopWork();
-        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time_between_calls));
+        stats = dullahan::dullahan_update_stats();
     }
+}
 
-    // browser for this instance - empty URL and no extra_info
-    mBrowser = CefBrowserHost::CreateBrowserSync(window_info, mBrowserClient.get(), std::string(), browser_settings, nullptr, mRequestContext.get());
-
-    // important: set the size *after* we create a browser
-    setSize(user_settings.initial_width, user_settings.initial_height);
+void dullahan_impl::resetUpdateStats()
+{
+    if (mEngine.get())
+    {
+        mEngine->resetUpdateStats();
+    }
+}
 
-    // recent versions of CEF seem to be pickier (rightly so) about calling dullahan_impl::update()
-    // before initialization has completed so we should block that until we're fully complete here
-    mInitialized = true;
+int dullahan_impl::getUpdateDelay()
+{
+    if (mEngine.get())
+    {
+        return mEngine->getUpdateDelay();
+    }
 
-    return true;
+    return 0;
 }
 
-void dullahan_impl::shutdown()
+int dullahan_impl::getUpdateFd()
 {
-    mBrowser = nullptr;
-    mRenderHandler = nullptr;
-    mBrowserClient = nullptr;
-    mRequestContext = nullptr;
+    if (mEngine.get())
+    {
+        return mEngine->getUpdateFd();
+    }
 
-    CefShutdown();
+    return -1;
 }
 
-void dullahan_impl::requestExit()
+// the work each browser does once CEF has had its turn
+void dullahan_impl::updateBrowser()
 {
-    if (mBrowser.get() && mBrowser->GetHost())
+    if (! mInitialized)
     {
-        flushAllCookies();
+        return;
+    }
 
-        bool force_close = false;
+    // a page that won't close or a cookie store that won't flush doesn't get to hold up exit
+    if (mExitPending && std::chrono::steady_clock::now() - mExitStart >= std::chrono::milliseconds(mExitTimeoutMs))
+    {
+        if (!mExitBrowserClosed && mBrowser.get() && mBrowser->GetHost())
+        {
+            bool force_close = true;
+            mBrowser->GetHost()->CloseBrowser(force_close);
+        }
 
-        mBrowser->GetHost()->CloseBrowser(force_close);
+        // the consumer hears about it now - not again when the browser finally goes
+        mExitBrowserClosed = true;
+        finishExit(true);
+        return;
     }
-}
 
-void dullahan_impl::getSize(int& width, int& height)
-{
-    width = mViewWidth;
-    height = mViewHeight;
+    updateCookieFlush();
+    deliverCookieChanges();
+
+    // a page that doesn't change at all doesn't paint either so we
+    // can't rely on counting paints to notice it has gone quiet
+    if (mAdaptiveFrameRate && !mFrameRateIdle)
+    {
+        const auto quiet_time = std::chrono::steady_clock::now() - mLastBusyTime;
+        if (quiet_time >= std::chrono::milliseconds(mIdlePaintCount * 1000 / fullFrameRate()))
+        {
+            idleFrameRate();
+        }
+    }
+
+    // CEF/Chromium resets page zoom in between pages
+    // so we continually try to set it to the value selected
+    // in calls to setPageZoom. Once the required zoom
+    // level is reached this call is almost free.
+    requestPageZoom();
 }
 
-void dullahan_impl::setSize(int width, int height)
+// hand out the callbacks held for the consumer's thread - the newest frame (if there
+// is one we haven't handed out) goes first since the others may refer to it
+void dullahan_impl::deliverCallbacks()
 {
-    DLNOUT("dullahan_impl::setSize() << width << " << width << " x " << height);
+    if (!mCallbacksOnUpdateThread)
+    {
+        return;
+    }
 
-    if (mBrowser.get() && mBrowser->GetHost())
+    dullahan::dullahan_frame frame;
+    if (mFrameExchange->acquire(frame))
     {
-        mViewWidth = width;
-        mViewHeight = height;
-        mBrowser->GetHost()->WasResized();
+        mCallbackManager->deliverPageChanged(frame);
     }
-}
 
-int dullahan_impl::getDepth()
-{
-    return mViewDepth;
+    mCallbackManager->deliverDeferred();
 }
 
-bool dullahan_impl::getFlipPixelsY()
+bool dullahan_impl::isMultiThreaded()
 {
-    return mFlipPixelsY;
+    return mMultiThreaded;
 }
 
-bool dullahan_impl::getFlipMouseY()
+void dullahan_impl::setMultiThreaded(bool multi_threaded)
 {
-    return mFlipMouseY;
+    mMultiThreaded = multi_threaded;
 }
 
-void dullahan_impl::run()
+void dullahan_impl::post(std::function<void()> command)
 {
-    CefRunMessageLoop();
+    // no browser for it to act on yet
+    {
+        std::lock_guard<std::mutex> lock(mPendingMutex);
+        if (mInitPending)
+        {
+            mPendingCommands.push_back(command);
+            return;
+        }
+    }
+
+    if (mEngine.get())
+    {
+        mEngine->post(command);
+    }
+    else
+    {
+        command();
+    }
 }
 
-void dullahan_impl::update()
+void dullahan_impl::wait(std::function<void()> command)
 {
-    if (! mInitialized)
+    if (mEngine.get())
     {
-        return;
+        mEngine->wait(command);
+    }
+    else
+    {
+        command();
     }
-
-    CefDoMessageLoopWork();
-
-    // CEF/Chromium resets page zoom in between pages
-    // so we continually try to set it to the value selected
-    // in calls to setPageZoom. Once the required zoom
-    // level is reached this call is almost free.
-    requestPageZoom();
 }
 
 bool dullahan_impl::canGoBack()
@@ -646,6 +996,11 @@ void dullahan_impl::navigate(const std::string url)
     {
         mBrowser->GetMainFrame()->LoadURL(url);
     }
+    else if (mLifecycleState == dullahan::LS_DISCARDED)
+    {
+        // goes there when it is brought back
+        mDiscardedURL = url;
+    }
 }
 
 void dullahan_impl::setFocus()
@@ -812,231 +1167,329 @@ void dullahan_impl::setPageZoom(const double zoom_val)
     requestPageZoom();
 }
 
-void dullahan_impl::showDevTools()
+void dullahan_impl::setVisible(bool visible)
 {
-    if (mBrowser.get() && mBrowser->GetHost())
+    if (visible == mVisible)
     {
-        CefWindowInfo window_info;
-        window_info.bounds = { 0,0, 600, 800 };
-#ifdef WIN32
-        window_info.SetAsPopup(nullptr, "Dullahan Dev Tools");
-#elif __APPLE__
-        // TODO: need Apple equivalent
-#endif
-        CefRefPtr<CefClient> client = mBrowserClient;
-        CefBrowserSettings browser_settings;
-        CefPoint inspect_element_at;
-        mBrowser->GetHost()->ShowDevTools(window_info, client, browser_settings,
-                                          inspect_element_at);
+        return;
     }
+    mVisible = visible;
+
+    applyVisibility();
 }
 
-void dullahan_impl::closeDevTools()
+// the page is only rendered if someone can see it and it isn't frozen or discarded
+bool dullahan_impl::isRendering()
+{
+    return mVisible && (mLifecycleState == dullahan::LS_ACTIVE || mLifecycleState == dullahan::LS_THROTTLED);
+}
+
+void dullahan_impl::applyVisibility()
 {
+    const bool rendering = isRendering();
+
+    if (mRenderHandler.get())
+    {
+        mRenderHandler->setVisible(rendering);
+    }
+
     if (mBrowser.get() && mBrowser->GetHost())
     {
-        mBrowser->GetHost()->CloseDevTools();
+        // hidden browsers stop producing frames and throttle their timers
+        mBrowser->GetHost()->WasHidden(!rendering);
+
+        // ask for everything straight away rather than waiting for the page to change
+        if (rendering)
+        {
+            mBrowser->GetHost()->Invalidate(PET_VIEW);
+            mBrowser->GetHost()->Invalidate(PET_POPUP);
+            wakeFrameRate();
+        }
     }
 }
 
-void dullahan_impl::printToPDF(const std::string path)
+bool dullahan_impl::isVisible()
+{
+    return mVisible;
+}
+
+void dullahan_impl::setVisibleRegion(int x, int y, int width, int height)
+{
+    if (mRenderHandler.get())
+    {
+        const bool everything = width <= 0 || height <= 0;
+        mRenderHandler->setVisibleRegion(everything ? CefRect() : CefRect(x, y, width, height));
+
+        // parts that just came into view need painting even if they haven't changed
+        if (mBrowser.get() && mBrowser->GetHost())
+        {
+            mBrowser->GetHost()->Invalidate(PET_VIEW);
+        }
+    }
+}
+
+void dullahan_impl::setFrameRate(int frame_rate)
 {
+    // CEF clamps it to this range anyway
+    mFrameRate = std::max(1, std::min(frame_rate, 60));
+    mQuietPaints = 0;
+    mFrameRateIdle = false;
+    mLastBusyTime = std::chrono::steady_clock::now();
+
     if (mBrowser.get() && mBrowser->GetHost())
     {
-        CefPdfPrintSettings settings;
-        settings.print_background = true;
-        settings.display_header_footer = true;
-        settings.landscape = true;
-        CefRefPtr<CefPdfPrintCallback> callback = this;
-        mBrowser->GetHost()->PrintToPDF(path, settings, callback);
+        mBrowser->GetHost()->SetWindowlessFrameRate(fullFrameRate());
     }
 }
 
-void dullahan_impl::OnPdfPrintFinished(const CefString& path, bool ok)
+int dullahan_impl::getFrameRate()
 {
-    getCallbackManager()->onPdfPrintFinished(path, ok);
+    return mFrameRate;
 }
 
-bool dullahan_impl::setCookie(const std::string url, const std::string name,
-                              const std::string value, const std::string domain,
-                              const std::string path, bool httponly, bool secure)
+// the rate the page runs at when it is busy - lower than the one asked for when throttled
+int dullahan_impl::fullFrameRate()
 {
-    CefRefPtr<CefCookieManager> manager;
+    if (mLifecycleState == dullahan::LS_THROTTLED)
+    {
+        return std::min(mFrameRate, mThrottledFrameRate);
+    }
 
-    if (mRequestContext)
+    return mFrameRate;
+}
+
+// Called for every frame the render handler passes on with the area that
+// changed. A run of paints that only touch a tiny part of the page (a blinking
+// caret, a spinner) drops the browser to the idle rate and a paint that changes
+// a decent chunk of it (scrolling, video) brings it straight back.
+void dullahan_impl::onPaintDamage(int64_t damage_area, int64_t page_area)
+{
+    if (!mAdaptiveFrameRate)
     {
-        manager = mRequestContext->GetCookieManager(nullptr);
+        return;
     }
-    else
+
+    // anything over 1% of the page counts as real activity
+    if (damage_area * 100 > page_area)
     {
-        manager = CefCookieManager::GetGlobalManager(nullptr);
+        wakeFrameRate();
+        return;
     }
 
-    if (manager)
+    if (!mFrameRateIdle && ++mQuietPaints >= mIdlePaintCount)
     {
-        CefCookie cookie;
-        CefString(&cookie.name) = name;
-        CefString(&cookie.value) = value;
-        CefString(&cookie.domain) = domain;
-        CefString(&cookie.path) = path;
+        idleFrameRate();
+    }
+}
 
-        cookie.httponly = httponly;
-        cookie.secure = secure;
+void dullahan_impl::idleFrameRate()
+{
+    const int frame_rate = std::min(mIdleFrameRate, fullFrameRate());
+    DLNOUT("Page is idle - dropping frame rate to " << frame_rate);
+    mFrameRateIdle = true;
+    if (mBrowser.get() && mBrowser->GetHost())
+    {
+        mBrowser->GetHost()->SetWindowlessFrameRate(frame_rate);
+    }
+}
 
-        cookie.has_expires = false;
+void dullahan_impl::wakeFrameRate()
+{
+    mQuietPaints = 0;
+    mLastBusyTime = std::chrono::steady_clock::now();
 
-        // wait for cookie to be set in setCookie callback
-        class setCookieCallback :
-            public CefSetCookieCallback
+    if (mFrameRateIdle)
+    {
+        DLNOUT("Page is active - restoring frame rate to " << fullFrameRate());
+        mFrameRateIdle = false;
+        if (mBrowser.get() && mBrowser->GetHost())
         {
-            public:
-                explicit setCookieCallback(CefRefPtr<CefWaitableEvent> event)
-                    : mEvent(event)
-                {
-                }
-
-                void OnComplete(bool success) override
-                {
-                    mEvent->Signal();
-                }
-
-            private:
-                CefRefPtr<CefWaitableEvent> mEvent;
-
-                IMPLEMENT_REFCOUNTING(setCookieCallback);
-        };
-
-        bool automatically_reset = true;
-        bool initially_signaled = false;
-        CefRefPtr<CefWaitableEvent> event = CefWaitableEvent::CreateWaitableEvent(automatically_reset, initially_signaled);
-
-        bool result = manager->SetCookie(url, cookie, new setCookieCallback(event));
-
-        event->Wait();
-
-        flushAllCookies();
-
-        return result;
+            mBrowser->GetHost()->SetWindowlessFrameRate(fullFrameRate());
+        }
     }
-
-    return false;
 }
 
-// TODO: This does not pass back the vector of strings correctly.
-//       Plus we should consider adding a cookie class and use that to represent a cookie vs. just name as a string
-const std::vector<std::string> dullahan_impl::getAllCookies()
+// Each step down the lifecycle saves more at the cost of a slower way back. Throttled
+// just caps the frame rate, frozen stops JavaScript and rendering but keeps the page
+// and discarded closes the browser - freeing the renderer - keeping only what we need
+// to bring it back: the URL and a compressed copy of the last frame.
+void dullahan_impl::setLifecycleState(dullahan::ELifecycleState state)
 {
-    class CookieVisitor : public CefCookieVisitor
+    if (state == mLifecycleState)
     {
-        public:
-            CookieVisitor(std::vector<std::string> cookies) :
-                mCookies(cookies)
-            {
-            }
+        return;
+    }
 
-            bool Visit(const CefCookie& cookie, int count, int total, bool& deleteCookie) override
-            {
-                const std::string name = std::string(CefString(&cookie.name));
-                const std::string value = std::string(CefString(&cookie.value));
+    const dullahan::ELifecycleState previous = mLifecycleState;
+    mLifecycleState = state;
 
-                mCookies.push_back(name);
-                deleteCookie = false;
-                return true;
-            }
+    // nothing to apply it to yet - init() does it once there is a browser
+    if (!mInitialized)
+    {
+        return;
+    }
 
-        private:
-            std::vector<std::string> mCookies;
+    DLNOUT("Lifecycle state changing from " << previous << " to " << state);
 
-            IMPLEMENT_REFCOUNTING(CookieVisitor);
-    };
+    if (previous == dullahan::LS_DISCARDED)
+    {
+        restoreBrowser();
+    }
+    else if (previous == dullahan::LS_FROZEN && state != dullahan::LS_DISCARDED)
+    {
+        setWebLifecycleState("active");
+    }
 
-    std::vector<std::string> cookies;
-    CefRefPtr<CefCookieManager> manager;
-    if (mRequestContext)
+    if (state == dullahan::LS_FROZEN)
     {
-        manager = mRequestContext->GetCookieManager(nullptr);
+        setWebLifecycleState("frozen");
     }
-    else
+    else if (state == dullahan::LS_DISCARDED)
     {
-        manager = CefCookieManager::GetGlobalManager(nullptr);
+        discardBrowser();
+        return;
     }
-    if (manager)
+
+    // frame rate goes to whatever suits the new state
+    mFrameRateIdle = false;
+    mQuietPaints = 0;
+    mLastBusyTime = std::chrono::steady_clock::now();
+    if (mBrowser.get() && mBrowser->GetHost())
     {
-        manager->VisitAllCookies(new CookieVisitor(cookies));
-        manager->FlushStore(nullptr);
+        mBrowser->GetHost()->SetWindowlessFrameRate(fullFrameRate());
+    }
 
-        return cookies;
+    // moving between active and throttled doesn't change whether we render
+    const bool was_rendering = previous == dullahan::LS_ACTIVE || previous == dullahan::LS_THROTTLED;
+    if (was_rendering != (state == dullahan::LS_ACTIVE || state == dullahan::LS_THROTTLED))
+    {
+        applyVisibility();
     }
+}
 
-    return std::vector<std::string>();
+dullahan::ELifecycleState dullahan_impl::getLifecycleState()
+{
+    return mLifecycleState;
 }
 
-void dullahan_impl::deleteAllCookies()
+// freezing the page stops JavaScript timers and tasks as well as rendering - see
+// https://chromedevtools.github.io/devtools-protocol/tot/Page/#method-setWebLifecycleState
+void dullahan_impl::setWebLifecycleState(const std::string state)
 {
-    CefRefPtr<CefCookieManager> manager;
-    if (mRequestContext)
+    if (mBrowser.get() && mBrowser->GetHost())
     {
-        manager = mRequestContext->GetCookieManager(nullptr);
+        CefRefPtr<CefDictionaryValue> params = CefDictionaryValue::Create();
+        params->SetString("state", state);
+
+        const int message_id = 0;
+        mBrowser->GetHost()->ExecuteDevToolsMethod(message_id, "Page.setWebLifecycleState", params);
     }
-    else
+}
+
+void dullahan_impl::discardBrowser()
+{
+    if (!mBrowser.get() || !mBrowser->GetHost())
     {
-        manager = CefCookieManager::GetGlobalManager(nullptr);
+        return;
     }
-    if (manager)
+
+    if (mBrowser->GetMainFrame())
     {
-        // empty URL deletes all cookies for all domains
-        const CefString url("");
-        const CefString name("");
-        const CefRefPtr<CefDeleteCookiesCallback> callback = nullptr;
-        manager->DeleteCookies(url, name, callback);
+        mDiscardedURL = mBrowser->GetMainFrame()->GetURL();
     }
-}
 
-void dullahan_impl::flushAllCookies()
-{
-    CefRefPtr<CefCookieManager> manager;
-    if (mRequestContext)
+    if (mRenderHandler.get())
     {
-        manager = mRequestContext->GetCookieManager(nullptr);
+        mRenderHandler->discardPixels();
     }
-    else
+
+    // this close isn't the consumer asking to exit so OnBeforeClose(..) mustn't say it is
+    mDiscardPending = true;
+
+    // forced close - no beforeunload handlers since nobody is there to answer them
+    bool force_close = true;
+    mBrowser->GetHost()->CloseBrowser(force_close);
+    mBrowser = nullptr;
+
+    DLNOUT("Discarded browser showing " << mDiscardedURL);
+}
+
+void dullahan_impl::restoreBrowser()
+{
+    DLNOUT("Restoring discarded browser showing " << mDiscardedURL);
+
+    mFrameRateIdle = false;
+    mBrowserSettings.windowless_frame_rate = fullFrameRate();
+
+    if (!createBrowser(mDiscardedURL, mViewWidth, mViewHeight))
     {
-        manager = CefCookieManager::GetGlobalManager(nullptr);
+        return;
     }
 
-    if (manager)
-    {
-        class flushStoreCallback :
-            public CefCompletionCallback
-        {
-            public:
-                explicit flushStoreCallback(CefRefPtr<CefWaitableEvent> event)
-                    : mEvent(event)
-                {
-                }
+    // the new browser is in the list now so the old one closing won't look like an exit
+    mDiscardPending = false;
+    mDiscardedURL.clear();
 
-                void OnComplete() override
-                {
-                    mEvent->Signal();
-                }
+    // show the page as it was until the new browser paints
+    if (mRenderHandler.get())
+    {
+        mRenderHandler->restorePixels();
+    }
+}
 
-            private:
-                CefRefPtr<CefWaitableEvent> mEvent;
+bool dullahan_impl::browserWasDiscarded()
+{
+    const bool discarded = mDiscardPending;
+    mDiscardPending = false;
 
-                IMPLEMENT_REFCOUNTING(flushStoreCallback);
-        };
+    return discarded;
+}
 
-        bool automatically_reset = true;
-        bool initially_signaled = false;
-        CefRefPtr<CefWaitableEvent> event = CefWaitableEvent::CreateWaitableEvent(automatically_reset, initially_signaled);
+void dullahan_impl::showDevTools()
+{
+    if (mBrowser.get() && mBrowser->GetHost())
+    {
+        CefWindowInfo window_info;
+        window_info.bounds = { 0,0, 600, 800 };
+#ifdef WIN32
+        window_info.SetAsPopup(nullptr, "Dullahan Dev Tools");
+#elif __APPLE__
+        // TODO: need Apple equivalent
+#endif
+        CefRefPtr<CefClient> client = mBrowserClient;
+        CefBrowserSettings browser_settings;
+        CefPoint inspect_element_at;
+        mBrowser->GetHost()->ShowDevTools(window_info, client, browser_settings,
+                                          inspect_element_at);
+    }
+}
 
-        const CefRefPtr<CefCompletionCallback> flush_store_callback = new flushStoreCallback(event);
-        manager->FlushStore(flush_store_callback);
+void dullahan_impl::closeDevTools()
+{
+    if (mBrowser.get() && mBrowser->GetHost())
+    {
+        mBrowser->GetHost()->CloseDevTools();
+    }
+}
 
-        event->Wait();
+void dullahan_impl::printToPDF(const std::string path)
+{
+    if (mBrowser.get() && mBrowser->GetHost())
+    {
+        CefPdfPrintSettings settings;
+        settings.print_background = true;
+        settings.display_header_footer = true;
+        settings.landscape = true;
+        CefRefPtr<CefPdfPrintCallback> callback = this;
+        mBrowser->GetHost()->PrintToPDF(path, settings, callback);
     }
 }
 
+void dullahan_impl::OnPdfPrintFinished(const CefString& path, bool ok)
+{
+    getCallbackManager()->onPdfPrintFinished(path, ok);
+}
+
 void dullahan_impl::postData(const std::string url, const std::string data,
                              const std::string headers)
 {
@@ -29,8 +29,12 @@
 
 #define NOMINMAX
 
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <chrono>
 
 #include "cef_app.h"
 #ifndef CEF_INCLUDE_CEF_VERSION_H_
@@ -43,31 +47,64 @@
 class dullahan_browser_client;
 class dullahan_render_handler;
 class dullahan_callback_manager;
+class dullahan_frame_exchange;
+class dullahan_engine_impl;
 class CefRequestContext;
+class CefCookieManager;
 
 class dullahan_impl :
-    public CefApp,
     public CefPdfPrintCallback
 {
-        void platormInitWidevine(std::string cachePath);
-        void platformAddCommandLines(CefRefPtr<CefCommandLine> command_line);
     public:
         dullahan_impl();
         ~dullahan_impl();
 
-        // CefApp overrides
-        virtual void OnBeforeCommandLineProcessing(const CefString& process_type, CefRefPtr<CefCommandLine> command_line) override;
-
+        // create the browser in an engine of its own or one shared with other browsers
         bool init(dullahan::dullahan_settings& user_settings);
+        bool init(CefRefPtr<dullahan_engine_impl> engine, dullahan::dullahan_settings& user_settings);
+
+        // same but return straight away - the browser is created (and the ready callback
+        // made) once the engine is ready, which it tells us about with onEngineReady()
+        bool initAsync(dullahan::dullahan_settings& user_settings);
+        bool initAsync(CefRefPtr<dullahan_engine_impl> engine, dullahan::dullahan_settings& user_settings);
+        void onEngineReady();
+
+        // CEF browser settings that match the ones the consumer asked for
+        static void makeBrowserSettings(const dullahan::dullahan_settings& user_settings, CefBrowserSettings& browser_settings);
         void shutdown();
         void requestExit();
+        void getShutdownStats(dullahan::dullahan_shutdown_stats& stats);
+
+        // the two things requestExit() waits for before telling the consumer
+        void onCookiesFlushed();
+        void onBrowserClosed();
 
         void getSize(int& width, int& height);
         void setSize(int width, int height);
         int getDepth();
+        void setPixelBuffer(const dullahan::dullahan_pixel_buffer& buffer);
+        bool acquireLatestFrame(dullahan::dullahan_frame& frame);
+        bool acquireFrame(uint64_t last_sequence, dullahan::dullahan_frame& frame);
+        size_t getPixelMemoryFootprint();
+        int getViewDepth();
+        dullahan::EPixelFormat getPixelFormat();
 
         void run();
         void update();
+        dullahan::dullahan_update_result update(int64_t budget_us);
+        void getUpdateStats(dullahan::dullahan_update_stats& stats);
+        void resetUpdateStats();
+        void updateBrowser();
+        void deliverCallbacks();
+        int getUpdateDelay();
+        int getUpdateFd();
+
+        // run on CEF's UI thread - straight away unless CEF runs that thread itself
+        // and we are on another one, in which case it is queued (and maybe waited for)
+        bool isMultiThreaded();
+        void setMultiThreaded(bool multi_threaded);
+        void post(std::function<void()> command);
+        void wait(std::function<void()> command);
 
         bool canGoBack();
         void goBack();
@@ -77,7 +114,7 @@ class dullahan_impl :
         void reload(const bool ignore_cache);
         void stop();
 
-        std::string makeCompatibleUserAgentString(const std::string base);
+        static std::string makeCompatibleUserAgentString(const std::string base);
 
         void mouseButton(dullahan::EMouseButton mouse_button,
                          dullahan::EMouseEvent mouse_event, int x, int y);
@@ -125,7 +162,24 @@ class dullahan_impl :
                        const std::string domain, const std::string path, bool httponly, bool secure);
         const std::vector<std::string> getAllCookies();
         void deleteAllCookies();
-        void flushAllCookies();
+        void setCookies(const std::vector<dullahan::dullahan_cookie>& cookies,
+                        std::function<void(int num_set)> on_done);
+        void flushCookies(std::function<void()> on_done);
+        void getCookies(const std::string url_filter,
+                        std::function<void(const std::vector<dullahan::dullahan_cookie>& cookies, bool last)> callback);
+        void exportCookies(const std::string path, dullahan::ECookieFileFormat format,
+                           std::function<void(bool ok, int num_cookies)> on_done);
+        void importCookies(const std::string path,
+                           std::function<void(bool ok, int num_cookies)> on_done);
+
+        // cookie observers - changes can come in on any thread and are handed
+        // on from updateBrowser(), one per cookie with its latest state
+        int addCookieObserver(const std::string domain, const std::string name,
+                              std::function<void(const dullahan::dullahan_cookie& cookie, dullahan::ECookieChange change)> callback);
+        void removeCookieObserver(int id);
+        bool hasCookieObservers();
+        void onCookieSaved(const CefCookie& cookie);
+        void onCookieChanged(const dullahan::dullahan_cookie& cookie, dullahan::ECookieChange change);
         void postData(const std::string url, const std::string data,
                       const std::string headers);
         bool executeJavaScript(const std::string cmd);
@@ -133,10 +187,31 @@ class dullahan_impl :
         dullahan_callback_manager* getCallbackManager();
 
         bool getFlipPixelsY();
+        bool getZeroCopyFrames();
+        bool getSuppressUnchangedFrames();
+        dullahan_frame_exchange* getFrameExchange();
         bool getFlipMouseY();
 
         void requestPageZoom();
 
+        void setVisible(bool visible);
+        bool isVisible();
+        void setVisibleRegion(int x, int y, int width, int height);
+
+        void setFrameRate(int frame_rate);
+        int getFrameRate();
+
+        // adaptive frame rate - paints report how much changed and anything
+        // the user does or a new page wakes it back up to the full rate
+        void onPaintDamage(int64_t damage_area, int64_t page_area);
+        void wakeFrameRate();
+
+        void setLifecycleState(dullahan::ELifecycleState state);
+        dullahan::ELifecycleState getLifecycleState();
+
+        // true (once) if the browser that just closed was discarded rather than exiting
+        bool browserWasDiscarded();
+
         void setCustomSchemes(std::vector<std::string> custom_schemes);
         std::vector<std::string>& getCustomSchemes();
 
@@ -145,43 +220,129 @@ class dullahan_impl :
 
         void showBrowserMessage(const std::string msg);
 
-        const std::string append_bitwidth_string(std::ostringstream& stream, bool show_bitwidth);
-        const std::string dullahan_cef_version(bool show_bitwidth);
-        const std::string dullahan_chrome_version(bool show_bitwidth);
-        const std::string dullahan_version(bool show_bitwidth);
-        const std::string composite_version();
+        static const std::string append_bitwidth_string(std::ostringstream& stream, bool show_bitwidth);
+        static const std::string dullahan_cef_version(bool show_bitwidth);
+        static const std::string dullahan_chrome_version(bool show_bitwidth);
+        static const std::string dullahan_version(bool show_bitwidth);
+        static const std::string composite_version();
 
         // CefPdfPrintCallback overrides
         void OnPdfPrintFinished(const CefString& path, bool ok) override;
 
     private:
-        bool initCEF(dullahan::dullahan_settings& user_settings);
+        bool createBrowser(const std::string url, int width, int height);
+        void idleFrameRate();
+        int fullFrameRate();
+        bool isRendering();
+        void applyVisibility();
+        void setWebLifecycleState(const std::string state);
+        void discardBrowser();
+        void restoreBrowser();
+        void checkExit();
+        void finishExit(bool timed_out);
+        CefRefPtr<CefCookieManager> getCookieManager();
+        void scheduleCookieFlush();
+        void updateCookieFlush();
+        void insertCookies(const std::vector<dullahan::dullahan_cookie>& cookies,
+                           std::function<void(int num_set)> on_set);
+        void deliverCookieChanges();
+        void visitCookies(const std::string url_filter,
+                          std::function<void(const std::vector<dullahan::dullahan_cookie>& cookies, bool last)> on_batch);
+
+        // the CEF instance this browser lives in - ours alone if we created it
+        CefRefPtr<dullahan_engine_impl> mEngine;
+        bool mOwnsEngine;
+
+        // the engine's request context or (RCP_EPHEMERAL) one of our own made in onEngineReady()
+        dullahan::ERequestContextPolicy mRequestContextPolicy;
+
+        // CEF runs its own UI thread and callbacks are held for the one update() is called on
+        bool mMultiThreaded;
+        bool mCallbacksOnUpdateThread;
+
+        // set between initAsync(..) and the browser being created - calls posted in
+        // the meantime are kept here and made, in order, once it exists
+        std::mutex mPendingMutex;
+        bool mInitPending;
+        std::vector<std::function<void()>> mPendingCommands;
+        int mInitialWidth;
+        int mInitialHeight;
+
+        // exit in progress - the cookie flush and the browser closing run side by side
+        // and whichever finishes last (or the deadline) lets the consumer know
+        class exit_flush_callback;
+        CefRefPtr<exit_flush_callback> mExitFlushCallback;
+        bool mExitPending;
+        bool mExitCookiesFlushed;
+        bool mExitBrowserClosed;
+        int mExitTimeoutMs;
+        std::chrono::steady_clock::time_point mExitStart;
+        dullahan::dullahan_shutdown_stats mShutdownStats;
+
+        // CEF can answer cookie calls after we have gone - their callbacks
+        // hold a copy of this and only use it while it still points at us
+        std::shared_ptr<dullahan_impl*> mSelf;
+
+        // cookies have been set since the store was last written - it is
+        // written once mCookieFlushDue comes round (see updateCookieFlush())
+        int mCookieFlushDelayMs;
+        bool mCookieFlushPending;
+        std::chrono::steady_clock::time_point mCookieFlushDue;
+
+        struct cookie_observer
+        {
+            int id;
+            std::string domain;
+            std::string name;
+            std::function<void(const dullahan::dullahan_cookie&, dullahan::ECookieChange)> callback;
+        };
+        struct cookie_change
+        {
+            dullahan::dullahan_cookie cookie;
+            dullahan::ECookieChange change;
+        };
+        std::mutex mCookieObserverMutex;
+        std::vector<cookie_observer> mCookieObservers;
+        std::vector<cookie_change> mCookieChanges;
+        int mNextCookieObserverId;
+        std::atomic<bool> mHasCookieObservers;
+
+        // buffer the consumer gave us before there was a render handler to take it
+        dullahan::dullahan_pixel_buffer mPendingPixelBuffer;
+        bool mHasPendingPixelBuffer;
 
         CefRefPtr<dullahan_browser_client> mBrowserClient;
         CefRefPtr<dullahan_render_handler> mRenderHandler;
         CefRefPtr<CefRequestContext> mRequestContext;
         CefRefPtr<CefBrowser> mBrowser;
+        CefBrowserSettings mBrowserSettings;
         dullahan_callback_manager* mCallbackManager;
+        dullahan_frame_exchange* mFrameExchange;
 
         bool mInitialized;
         int mViewWidth;
         int mViewHeight;
-        std::string mProxyHostPort;
-        bool mSystemFlashEnabled;
-        bool mMediaStreamEnabled;
-        bool mBeginFrameScheduling;
-        bool mForceWaveAudio;
-        bool mDisableGPU;
-        bool mDisableWebSecurity;
-        bool mAllowFileAccessFromFiles;
-        bool mDisableNetworkService;
-        bool mUseMockKeyChain;
-        bool mAutoPlayWithoutGesture;
-        bool mFakeUIForMediaStream;
         bool mFlipPixelsY;
+        bool mZeroCopyFrames;
+        bool mSuppressUnchangedFrames;
+        bool mThreadedFrameExchange;
         bool mFlipMouseY;
         double mRequestedPageZoom;
+        bool mVisible;
+        int mFrameRate;
+        bool mAdaptiveFrameRate;
+        int mIdleFrameRate;
+        int mIdlePaintCount;
+        int mQuietPaints;
+        bool mFrameRateIdle;
+        std::chrono::steady_clock::time_point mLastBusyTime;
+        dullahan::ELifecycleState mLifecycleState;
+        int mThrottledFrameRate;
+        std::string mDiscardedURL;
+        bool mDiscardPending;
         const int mViewDepth = 4;
+        dullahan::EPixelFormat mPixelFormat;
+        int mPixelDepth;
         std::vector<std::string> mCustomSchemes;
 
         IMPLEMENT_REFCOUNTING(dullahan_impl);
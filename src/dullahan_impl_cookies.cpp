@@ -0,0 +1,690 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "dullahan_impl.h"
+#include "dullahan_callback_manager.h"
+#include "dullahan_cookie_file.h"
+
+#include "include/cef_request_context.h"
+#include "include/cef_waitable_event.h"
+
+#include <ctime>
+#include <thread>
+
+namespace
+{
+// cookies handed to the consumer per getCookies(..) callback
+const size_t COOKIE_BATCH_SIZE = 100;
+
+// longest the old getCookies() waits for the cookie store
+const int MAX_COOKIE_WAIT_MS = 2000;
+
+// CefCookie from the consumer's description of one
+CefCookie makeCefCookie(const dullahan::dullahan_cookie& cookie)
+{
+    CefCookie cef_cookie;
+    CefString(&cef_cookie.name) = cookie.name;
+    CefString(&cef_cookie.value) = cookie.value;
+    CefString(&cef_cookie.domain) = cookie.domain;
+    CefString(&cef_cookie.path) = cookie.path;
+
+    cef_cookie.httponly = cookie.httponly;
+    cef_cookie.secure = cookie.secure;
+
+    cef_cookie.has_expires = cookie.expires > 0;
+    if (cef_cookie.has_expires)
+    {
+        CefTime expires;
+        expires.SetTimeT(static_cast<time_t>(cookie.expires));
+        cef_time_to_basetime(&expires, &cef_cookie.expires);
+    }
+
+    return cef_cookie;
+}
+
+// the consumer's description of a cookie CEF gave us
+dullahan::dullahan_cookie makeDullahanCookie(const CefCookie& cef_cookie)
+{
+    dullahan::dullahan_cookie cookie;
+    cookie.name = CefString(&cef_cookie.name);
+    cookie.value = CefString(&cef_cookie.value);
+    cookie.domain = CefString(&cef_cookie.domain);
+    cookie.path = CefString(&cef_cookie.path);
+
+    cookie.httponly = cef_cookie.httponly != 0;
+    cookie.secure = cef_cookie.secure != 0;
+
+    if (cef_cookie.has_expires)
+    {
+        CefTime expires;
+        cef_time_from_basetime(cef_cookie.expires, &expires);
+        cookie.expires = static_cast<int64_t>(expires.GetTimeT());
+    }
+
+    return cookie;
+}
+
+// hands the cookies CEF visits on in batches - the last call has last set
+// and comes when the final cookie is visited, or when CEF lets go of us
+// without visiting any, or straight away if the visit never started
+class cookie_batch_visitor :
+    public CefCookieVisitor
+{
+    public:
+        explicit cookie_batch_visitor(std::function<void(const std::vector<dullahan::dullahan_cookie>& cookies, bool last)> on_batch) :
+            mOnBatch(on_batch),
+            mFinished(false)
+        {
+        }
+
+        ~cookie_batch_visitor() override
+        {
+            finish();
+        }
+
+        bool Visit(const CefCookie& cookie, int count, int total, bool& deleteCookie) override
+        {
+            mCookies.push_back(makeDullahanCookie(cookie));
+            deleteCookie = false;
+
+            if (count + 1 >= total)
+            {
+                finish();
+            }
+            else if (mCookies.size() >= COOKIE_BATCH_SIZE)
+            {
+                mOnBatch(mCookies, false);
+                mCookies.clear();
+            }
+
+            return true;
+        }
+
+        void finish()
+        {
+            if (!mFinished)
+            {
+                mFinished = true;
+                mOnBatch(mCookies, true);
+                mCookies.clear();
+            }
+        }
+
+    private:
+        std::function<void(const std::vector<dullahan::dullahan_cookie>&, bool)> mOnBatch;
+        std::vector<dullahan::dullahan_cookie> mCookies;
+        bool mFinished;
+
+        IMPLEMENT_REFCOUNTING(cookie_batch_visitor);
+};
+
+// setting a cookie that has already expired is how it gets deleted
+dullahan::ECookieChange getCookieChange(const dullahan::dullahan_cookie& cookie)
+{
+    if (cookie.expires > 0 && cookie.expires <= static_cast<int64_t>(time(nullptr)))
+    {
+        return dullahan::CC_DELETED;
+    }
+
+    return dullahan::CC_SET;
+}
+
+// a batch of SetCookie(..) calls - CEF answers every one on its UI thread
+struct set_cookies_batch
+{
+    size_t remaining = 0;
+    int num_set = 0;
+    std::function<void(int num_set)> on_done;
+    std::function<void(const dullahan::dullahan_cookie& cookie)> on_cookie_set;
+};
+
+// one cookie from a batch - the batch is done once the last of them has answered
+class set_cookies_callback :
+    public CefSetCookieCallback
+{
+    public:
+        set_cookies_callback(std::shared_ptr<set_cookies_batch> batch, const dullahan::dullahan_cookie& cookie) :
+            mBatch(batch),
+            mCookie(cookie)
+        {
+        }
+
+        void OnComplete(bool success) override
+        {
+            if (success)
+            {
+                ++mBatch->num_set;
+                mBatch->on_cookie_set(mCookie);
+            }
+
+            if (--mBatch->remaining == 0)
+            {
+                mBatch->on_done(mBatch->num_set);
+            }
+        }
+
+    private:
+        std::shared_ptr<set_cookies_batch> mBatch;
+        dullahan::dullahan_cookie mCookie;
+
+        IMPLEMENT_REFCOUNTING(set_cookies_callback);
+};
+
+// tells the consumer the cookie store has been written
+class flush_cookies_callback :
+    public CefCompletionCallback
+{
+    public:
+        flush_cookies_callback(std::shared_ptr<dullahan_impl*> parent, std::function<void()> on_done) :
+            mParent(parent),
+            mOnDone(on_done)
+        {
+        }
+
+        void OnComplete() override
+        {
+            if (mOnDone && *mParent)
+            {
+                (*mParent)->getCallbackManager()->onCompletion(mOnDone);
+            }
+        }
+
+    private:
+        std::shared_ptr<dullahan_impl*> mParent;
+        std::function<void()> mOnDone;
+
+        IMPLEMENT_REFCOUNTING(flush_cookies_callback);
+};
+}
+
+// the cookie store for the context our browser lives in
+CefRefPtr<CefCookieManager> dullahan_impl::getCookieManager()
+{
+    if (mRequestContext)
+    {
+        return mRequestContext->GetCookieManager(nullptr);
+    }
+
+    return CefCookieManager::GetGlobalManager(nullptr);
+}
+
+bool dullahan_impl::setCookie(const std::string url, const std::string name,
+                              const std::string value, const std::string domain,
+                              const std::string path, bool httponly, bool secure)
+{
+    CefRefPtr<CefCookieManager> manager = getCookieManager();
+    if (manager)
+    {
+        dullahan::dullahan_cookie cookie;
+        cookie.name = name;
+        cookie.value = value;
+        cookie.domain = domain;
+        cookie.path = path;
+        cookie.httponly = httponly;
+        cookie.secure = secure;
+
+        // wait for cookie to be set in setCookie callback
+        class setCookieCallback :
+            public CefSetCookieCallback
+        {
+            public:
+                explicit setCookieCallback(CefRefPtr<CefWaitableEvent> event)
+                    : mEvent(event)
+                {
+                }
+
+                void OnComplete(bool success) override
+                {
+                    mEvent->Signal();
+                }
+
+            private:
+                CefRefPtr<CefWaitableEvent> mEvent;
+
+                IMPLEMENT_REFCOUNTING(setCookieCallback);
+        };
+
+        bool result;
+
+        // CEF's UI thread can't wait when CEF runs it itself - the cookie is set soon after
+        if (mMultiThreaded && CefCurrentlyOn(TID_UI))
+        {
+            result = manager->SetCookie(url, makeCefCookie(cookie), nullptr);
+        }
+        else
+        {
+            bool automatically_reset = true;
+            bool initially_signaled = false;
+            CefRefPtr<CefWaitableEvent> event = CefWaitableEvent::CreateWaitableEvent(automatically_reset, initially_signaled);
+
+            result = manager->SetCookie(url, makeCefCookie(cookie), new setCookieCallback(event));
+            if (result)
+            {
+                event->Wait();
+            }
+        }
+
+        if (result)
+        {
+            cookie.url = url;
+            onCookieChanged(cookie, dullahan::CC_SET);
+        }
+
+        // written to disk along with any others set around the same time
+        post([this]()
+        {
+            scheduleCookieFlush();
+        });
+
+        return result;
+    }
+
+    return false;
+}
+
+// Every cookie is handed to CEF straight away and counted back in as it is set -
+// on_set is made on CEF's UI thread once the last of them has been
+void dullahan_impl::insertCookies(const std::vector<dullahan::dullahan_cookie>& cookies,
+                                  std::function<void(int num_set)> on_set)
+{
+    CefRefPtr<CefCookieManager> manager = getCookieManager();
+    if (!manager || cookies.empty())
+    {
+        on_set(0);
+        return;
+    }
+
+    std::shared_ptr<dullahan_impl*> self = mSelf;
+    std::shared_ptr<set_cookies_batch> batch = std::make_shared<set_cookies_batch>();
+    batch->remaining = cookies.size();
+    batch->on_done = on_set;
+    batch->on_cookie_set = [self](const dullahan::dullahan_cookie& cookie)
+    {
+        if (*self)
+        {
+            (*self)->onCookieChanged(cookie, getCookieChange(cookie));
+        }
+    };
+
+    for (size_t i = 0; i < cookies.size(); ++i)
+    {
+        // CEF won't call back for one it turned down
+        CefRefPtr<set_cookies_callback> callback = new set_cookies_callback(batch, cookies[i]);
+        if (!manager->SetCookie(cookies[i].url, makeCefCookie(cookies[i]), callback.get()))
+        {
+            callback->OnComplete(false);
+        }
+    }
+}
+
+// nothing here waits - writing the cookies to disk is left to scheduleCookieFlush()
+void dullahan_impl::setCookies(const std::vector<dullahan::dullahan_cookie>& cookies,
+                               std::function<void(int num_set)> on_done)
+{
+    std::shared_ptr<dullahan_impl*> self = mSelf;
+    insertCookies(cookies, [self, on_done](int num_set)
+    {
+        if (on_done && *self)
+        {
+            (*self)->getCallbackManager()->onCompletion(std::bind(on_done, num_set));
+        }
+    });
+
+    scheduleCookieFlush();
+}
+
+// The whole jar is collected and then written with one call - from wherever callbacks
+// are made, so it is kept off CEF's thread when they are held for the consumer's
+void dullahan_impl::exportCookies(const std::string path, dullahan::ECookieFileFormat format,
+                                  std::function<void(bool ok, int num_cookies)> on_done)
+{
+    std::shared_ptr<std::vector<dullahan::dullahan_cookie>> jar = std::make_shared<std::vector<dullahan::dullahan_cookie>>();
+    std::shared_ptr<dullahan_impl*> self = mSelf;
+    visitCookies(std::string(), [self, jar, path, format, on_done](const std::vector<dullahan::dullahan_cookie>& cookies, bool last)
+    {
+        jar->insert(jar->end(), cookies.begin(), cookies.end());
+        if (last && *self)
+        {
+            (*self)->getCallbackManager()->onCompletion([jar, path, format, on_done]()
+            {
+                const bool ok = dullahan_cookie_file::save(path, format, *jar);
+                if (on_done)
+                {
+                    on_done(ok, ok ? static_cast<int>(jar->size()) : 0);
+                }
+            });
+        }
+    });
+}
+
+// The file is read on the caller's thread so CEF's only has to set the cookies -
+// as one batch followed by a single write of the cookie store
+void dullahan_impl::importCookies(const std::string path,
+                                  std::function<void(bool ok, int num_cookies)> on_done)
+{
+    std::vector<dullahan::dullahan_cookie> cookies;
+    if (!dullahan_cookie_file::load(path, cookies))
+    {
+        if (on_done)
+        {
+            getCallbackManager()->onCompletion(std::bind(on_done, false, 0));
+        }
+        return;
+    }
+
+    post([this, cookies, on_done]()
+    {
+        std::shared_ptr<dullahan_impl*> self = mSelf;
+        insertCookies(cookies, [self, on_done](int num_set)
+        {
+            if (*self)
+            {
+                std::function<void()> flushed;
+                if (on_done)
+                {
+                    flushed = std::bind(on_done, true, num_set);
+                }
+                (*self)->flushCookies(flushed);
+            }
+        });
+    });
+}
+
+void dullahan_impl::flushCookies(std::function<void()> on_done)
+{
+    // anything waiting for the timer goes now
+    mCookieFlushPending = false;
+
+    CefRefPtr<CefCookieManager> manager = getCookieManager();
+    if (!manager || !manager->FlushStore(new flush_cookies_callback(mSelf, on_done)))
+    {
+        // nothing to write
+        getCallbackManager()->onCompletion(on_done);
+    }
+}
+
+// A burst of cookies is written to disk in one go once the first of them has
+// waited cookie_flush_delay_ms - updateCookieFlush() keeps an eye on the time
+void dullahan_impl::scheduleCookieFlush()
+{
+    if (mCookieFlushDelayMs == 0)
+    {
+        flushCookies(nullptr);
+        return;
+    }
+
+    if (!mCookieFlushPending)
+    {
+        mCookieFlushPending = true;
+        mCookieFlushDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(mCookieFlushDelayMs);
+    }
+}
+
+void dullahan_impl::updateCookieFlush()
+{
+    if (mCookieFlushPending && std::chrono::steady_clock::now() >= mCookieFlushDue)
+    {
+        flushCookies(nullptr);
+    }
+}
+
+// Reads the whole cookie store without writing it - on_batch is made on CEF's UI thread
+void dullahan_impl::visitCookies(const std::string url_filter,
+                                 std::function<void(const std::vector<dullahan::dullahan_cookie>& cookies, bool last)> on_batch)
+{
+    CefRefPtr<cookie_batch_visitor> visitor = new cookie_batch_visitor(on_batch);
+
+    bool visiting = false;
+    CefRefPtr<CefCookieManager> manager = getCookieManager();
+    if (manager)
+    {
+        if (url_filter.empty())
+        {
+            visiting = manager->VisitAllCookies(visitor.get());
+        }
+        else
+        {
+            bool include_httponly = true;
+            visiting = manager->VisitUrlCookies(url_filter, include_httponly, visitor.get());
+        }
+    }
+
+    if (!visiting)
+    {
+        visitor->finish();
+    }
+}
+
+void dullahan_impl::getCookies(const std::string url_filter,
+                               std::function<void(const std::vector<dullahan::dullahan_cookie>& cookies, bool last)> callback)
+{
+    if (!callback)
+    {
+        return;
+    }
+
+    std::shared_ptr<dullahan_impl*> self = mSelf;
+    visitCookies(url_filter, [self, callback](const std::vector<dullahan::dullahan_cookie>& cookies, bool last)
+    {
+        if (*self)
+        {
+            (*self)->getCallbackManager()->onCompletion(std::bind(callback, cookies, last));
+        }
+    });
+}
+
+// Names of every cookie - waits for the visit to finish, keeping CEF's message
+// loop going if it is ours. CEF's own UI thread can't wait for itself so gets none
+const std::vector<std::string> dullahan_impl::getAllCookies()
+{
+    if (mMultiThreaded && CefCurrentlyOn(TID_UI))
+    {
+        return std::vector<std::string>();
+    }
+
+    struct visit_result
+    {
+        std::mutex mutex;
+        std::vector<std::string> names;
+        bool done = false;
+    };
+    std::shared_ptr<visit_result> result = std::make_shared<visit_result>();
+
+    visitCookies(std::string(), [result](const std::vector<dullahan::dullahan_cookie>& cookies, bool last)
+    {
+        std::lock_guard<std::mutex> lock(result->mutex);
+        for (size_t i = 0; i < cookies.size(); ++i)
+        {
+            result->names.push_back(cookies[i].name);
+        }
+        result->done = last;
+    });
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MAX_COOKIE_WAIT_MS);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        {
+            std::lock_guard<std::mutex> lock(result->mutex);
+            if (result->done)
+            {
+                break;
+            }
+        }
+
+        if (!mMultiThreaded)
+        {
+            CefDoMessageLoopWork();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::lock_guard<std::mutex> lock(result->mutex);
+    return result->names;
+}
+
+void dullahan_impl::deleteAllCookies()
+{
+    CefRefPtr<CefCookieManager> manager = getCookieManager();
+    if (manager)
+    {
+        // empty URL deletes all cookies for all domains
+        const CefString url("");
+        const CefString name("");
+        const CefRefPtr<CefDeleteCookiesCallback> callback = nullptr;
+        manager->DeleteCookies(url, name, callback);
+
+        onCookieChanged(dullahan::dullahan_cookie(), dullahan::CC_DELETED);
+    }
+}
+
+int dullahan_impl::addCookieObserver(const std::string domain, const std::string name,
+                                     std::function<void(const dullahan::dullahan_cookie& cookie, dullahan::ECookieChange change)> callback)
+{
+    if (!callback)
+    {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mCookieObserverMutex);
+
+    cookie_observer observer;
+    observer.id = mNextCookieObserverId++;
+    observer.domain = domain;
+    if (!observer.domain.empty() && observer.domain[0] == '.')
+    {
+        observer.domain.erase(0, 1);
+    }
+    observer.name = name;
+    observer.callback = callback;
+    mCookieObservers.push_back(observer);
+
+    mHasCookieObservers = true;
+    return observer.id;
+}
+
+void dullahan_impl::removeCookieObserver(int id)
+{
+    std::lock_guard<std::mutex> lock(mCookieObserverMutex);
+
+    for (auto iter = mCookieObservers.begin(); iter != mCookieObservers.end(); ++iter)
+    {
+        if (iter->id == id)
+        {
+            mCookieObservers.erase(iter);
+            break;
+        }
+    }
+
+    mHasCookieObservers = !mCookieObservers.empty();
+}
+
+bool dullahan_impl::hasCookieObservers()
+{
+    return mHasCookieObservers;
+}
+
+// a page set (or deleted) a cookie with a Set-Cookie header
+void dullahan_impl::onCookieSaved(const CefCookie& cookie)
+{
+    const dullahan::dullahan_cookie saved = makeDullahanCookie(cookie);
+    onCookieChanged(saved, getCookieChange(saved));
+}
+
+// Only the latest change to each cookie is kept until deliverCookieChanges() - a
+// page setting the same cookie over and over makes for one callback, not many
+void dullahan_impl::onCookieChanged(const dullahan::dullahan_cookie& cookie, dullahan::ECookieChange change)
+{
+    if (!mHasCookieObservers)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mCookieObserverMutex);
+
+    for (size_t i = 0; i < mCookieChanges.size(); ++i)
+    {
+        const dullahan::dullahan_cookie& pending = mCookieChanges[i].cookie;
+        if (pending.domain == cookie.domain && pending.name == cookie.name && pending.path == cookie.path)
+        {
+            mCookieChanges[i].cookie = cookie;
+            mCookieChanges[i].change = change;
+            return;
+        }
+    }
+
+    cookie_change pending;
+    pending.cookie = cookie;
+    pending.change = change;
+    mCookieChanges.push_back(pending);
+}
+
+// called once per update - each change goes to every observer it matches
+void dullahan_impl::deliverCookieChanges()
+{
+    std::vector<cookie_change> changes;
+    std::vector<cookie_observer> observers;
+    {
+        std::lock_guard<std::mutex> lock(mCookieObserverMutex);
+        if (mCookieChanges.empty())
+        {
+            return;
+        }
+        changes.swap(mCookieChanges);
+        observers = mCookieObservers;
+    }
+
+    for (size_t i = 0; i < changes.size(); ++i)
+    {
+        const dullahan::dullahan_cookie& cookie = changes[i].cookie;
+
+        // deleting every cookie has neither and matches everybody
+        const bool every_cookie = cookie.domain.empty() && cookie.name.empty();
+
+        std::string domain = cookie.domain;
+        if (!domain.empty() && domain[0] == '.')
+        {
+            domain.erase(0, 1);
+        }
+
+        for (size_t j = 0; j < observers.size(); ++j)
+        {
+            const cookie_observer& observer = observers[j];
+
+            bool domain_match = observer.domain.empty() || domain == observer.domain;
+            if (!domain_match && domain.size() > observer.domain.size())
+            {
+                const size_t dot = domain.size() - observer.domain.size() - 1;
+                domain_match = domain[dot] == '.' && domain.compare(dot + 1, std::string::npos, observer.domain) == 0;
+            }
+            const bool name_match = observer.name.empty() || cookie.name == observer.name;
+
+            if (every_cookie || (domain_match && name_match))
+            {
+                getCallbackManager()->onCompletion(std::bind(observer.callback, cookie, changes[i].change));
+            }
+        }
+    }
+}
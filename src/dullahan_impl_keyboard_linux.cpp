@@ -39,6 +39,8 @@ enum SDL_KeyPad
 
 void dullahan_impl::nativeKeyboardEvent(dullahan::EKeyEvent key_event, uint32_t native_scan_code, uint32_t native_virtual_key, uint32_t native_modifiers)
 {
+    wakeFrameRate();
+
     if (!mBrowser || !mBrowser->GetHost())
     {
         return;
@@ -181,6 +183,8 @@ bool isControlPressed(uint32_t mod)
 
 void dullahan_impl::nativeKeyboardEventSDL2(dullahan::EKeyEvent key_event, uint32_t key_data, uint32_t key_modifiers, bool keypad_input)
 {
+    wakeFrameRate();
+
     if (!mBrowser || !mBrowser->GetHost())
     {
         return;
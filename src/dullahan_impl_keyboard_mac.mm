@@ -62,6 +62,8 @@ void dullahan_impl::nativeKeyboardEventWin(uint32_t msg, uint32_t wparam, uint64
 
 void dullahan_impl::nativeKeyboardEventOSX(void* event)
 {
+    wakeFrameRate();
+
     if (mBrowser.get())
     {
         if (mBrowser->GetHost())
@@ -120,6 +122,8 @@ void dullahan_impl::nativeKeyboardEventOSX(dullahan::EKeyEvent event_type,
                                            uint32_t event_umodchars,
                                            bool event_isrepeat)
 {
+    wakeFrameRate();
+
     if (mBrowser.get())
     {
         if (mBrowser->GetHost())
@@ -143,6 +143,8 @@ int GetCefKeyboardModifiers(uint32_t msg, WPARAM wparam, LPARAM lparam)
 
 void dullahan_impl::nativeKeyboardEventWin(uint32_t msg, uint32_t wparam, uint64_t lparam)
 {
+    wakeFrameRate();
+
     if (mBrowser && mBrowser->GetHost())
     {
         CefKeyEvent event;
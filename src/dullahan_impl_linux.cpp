@@ -23,11 +23,11 @@ namespace
     }
 }
 
-void dullahan_impl::platormInitWidevine(std::string cachePath)
+void dullahan_engine_impl::platormInitWidevine(std::string cachePath)
 {
 }
 
-void dullahan_impl::platformAddCommandLines(CefRefPtr<CefCommandLine> command_line)
+void dullahan_engine_impl::platformAddCommandLines(CefRefPtr<CefCommandLine> command_line)
 {
     auto *pDisplay = getenv("DISPLAY");
     auto *pSessionType = getenv("XDG_SESSION_TYPE");
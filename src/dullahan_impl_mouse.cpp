@@ -29,6 +29,8 @@
 void dullahan_impl::mouseButton(dullahan::EMouseButton mouse_button,
                                 dullahan::EMouseEvent mouse_event, int x, int y)
 {
+    wakeFrameRate();
+
     // send to CEF
     if (mBrowser && mBrowser->GetHost())
     {
@@ -68,6 +70,8 @@ void dullahan_impl::mouseButton(dullahan::EMouseButton mouse_button,
 
 void dullahan_impl::mouseMove(int x, int y)
 {
+    wakeFrameRate();
+
     if (mBrowser && mBrowser->GetHost())
     {
         CefMouseEvent cef_mouse_event;
@@ -82,6 +86,8 @@ void dullahan_impl::mouseMove(int x, int y)
 
 void dullahan_impl::mouseWheel(int x, int y, int deltaX, int deltaY)
 {
+    wakeFrameRate();
+
     if (mBrowser && mBrowser->GetHost())
     {
         CefMouseEvent mouse_event;
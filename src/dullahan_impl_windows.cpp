@@ -1,9 +1,9 @@
 
-void dullahan_impl::platormInitWidevine(std::string cachePath)
+void dullahan_engine_impl::platormInitWidevine(std::string cachePath)
 {
 }
 
-void dullahan_impl::platformAddCommandLines(CefRefPtr<CefCommandLine> command_line)
+void dullahan_engine_impl::platformAddCommandLines(CefRefPtr<CefCommandLine> command_line)
 {
     if (mForceWaveAudio == true)
     {
@@ -0,0 +1,767 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "dullahan_pixel_kernels.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DULLAHAN_PIXEL_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC lets us use any intrinsic without special compiler flags
+#define DULLAHAN_TARGET_SSSE3
+#define DULLAHAN_TARGET_SSE42
+#define DULLAHAN_TARGET_AVX2
+#else
+#define DULLAHAN_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define DULLAHAN_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define DULLAHAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define DULLAHAN_PIXEL_KERNELS_NEON 1
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_CRC32)
+#define DULLAHAN_PIXEL_KERNELS_ARM_CRC 1
+#include <arm_acle.h>
+#endif
+#endif
+
+namespace
+{
+    // blocks bigger than this are unlikely to still be in cache by the time
+    // the consumer reads them so we bypass the cache when writing them
+    const size_t NON_TEMPORAL_THRESHOLD = 4 * 1024 * 1024;
+
+    // run length encoding - each packet starts with a 16 bit count and the top
+    // bit says if it's a run (one pixel repeated) or that many literal pixels
+    const unsigned int RLE_RUN_FLAG = 0x8000;
+    const int RLE_MAX_COUNT = 0x7fff;
+
+    // number of formats in dullahan::EPixelFormat
+    const int NUM_PIXEL_FORMATS = dullahan::PF_RGB24 + 1;
+
+    typedef void (*copy_row_func)(unsigned char* dst, const unsigned char* src, size_t bytes, bool streaming);
+    typedef void (*convert_row_func)(unsigned char* dst, const unsigned char* src, int pixels);
+    typedef uint64_t (*hash_row_func)(uint64_t hash, const unsigned char* src, size_t bytes);
+
+    struct kernel_table
+    {
+        copy_row_func copy_row;
+        convert_row_func convert_row[NUM_PIXEL_FORMATS];
+        hash_row_func hash_row;
+        bool needs_fence;
+        const char* name;
+    };
+
+    void copyRowScalar(unsigned char* dst, const unsigned char* src, size_t bytes, bool /*streaming*/)
+    {
+        memcpy(dst, src, bytes);
+    }
+
+    inline uint32_t loadPixel(const unsigned char* src)
+    {
+        uint32_t pixel;
+        memcpy(&pixel, src, sizeof(pixel));
+        return pixel;
+    }
+
+    inline void storePixel(unsigned char* dst, uint32_t pixel)
+    {
+        memcpy(dst, &pixel, sizeof(pixel));
+    }
+
+    void convertRowBGRAScalar(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        memcpy(dst, src, pixels * 4);
+    }
+
+    // swap the B and R bytes - endian neutral since we work on bytes
+    void convertRowRGBAScalar(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        for (int i = 0; i < pixels; ++i, dst += 4, src += 4)
+        {
+            const unsigned char b = src[0];
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = b;
+            dst[3] = src[3];
+        }
+    }
+
+    void convertRowXRGBScalar(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        for (int i = 0; i < pixels; ++i, dst += 4, src += 4)
+        {
+            uint32_t pixel = loadPixel(src);
+            storePixel(dst, pixel);
+            dst[3] = 0xff;
+        }
+    }
+
+    void convertRowRGB24Scalar(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        for (int i = 0; i < pixels; ++i, dst += 3, src += 4)
+        {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+        }
+    }
+
+    // The hashes only need to spot changes, not resist attack, so the fallback is a
+    // multiply/xor-shift per 8 bytes and the SIMD builds use the CPU's CRC32C
+    // instruction on two interleaved streams to get a 64 bit result
+    inline uint64_t mixHash(uint64_t hash, uint64_t word)
+    {
+        hash ^= word;
+        hash *= 0x9e3779b97f4a7c15ull;
+        return hash ^ (hash >> 29);
+    }
+
+    uint64_t hashRowScalar(uint64_t hash, const unsigned char* src, size_t bytes)
+    {
+        for (; bytes >= 8; bytes -= 8, src += 8)
+        {
+            uint64_t word;
+            memcpy(&word, src, sizeof(word));
+            hash = mixHash(hash, word);
+        }
+
+        if (bytes > 0)
+        {
+            uint64_t word = 0;
+            memcpy(&word, src, bytes);
+            hash = mixHash(hash, word);
+        }
+
+        return hash;
+    }
+
+    // Undoing premultiplied alpha is a divide per channel which doesn't map onto
+    // shuffles so the straight alpha formats use a table of 16.16 fixed point
+    // reciprocals instead. Opaque pixels - the vast majority on most pages - skip it.
+    struct unpremultiply_table
+    {
+        uint32_t scale[256];
+
+        unpremultiply_table()
+        {
+            scale[0] = 0;
+            for (uint32_t alpha = 1; alpha < 256; ++alpha)
+            {
+                scale[alpha] = ((255u << 16) + alpha / 2) / alpha;
+            }
+        }
+    };
+
+    inline unsigned char unpremultiply(unsigned char value, uint32_t scale)
+    {
+        const uint32_t result = (value * scale + 0x8000) >> 16;
+        return (unsigned char)(result > 255 ? 255 : result);
+    }
+
+    template <int R, int B>
+    void convertRowStraightScalar(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        static const unpremultiply_table table;
+
+        for (int i = 0; i < pixels; ++i, dst += 4, src += 4)
+        {
+            const unsigned char alpha = src[3];
+            if (alpha == 0xff)
+            {
+                dst[R] = src[2];
+                dst[1] = src[1];
+                dst[B] = src[0];
+            }
+            else
+            {
+                const uint32_t scale = table.scale[alpha];
+                dst[R] = unpremultiply(src[2], scale);
+                dst[1] = unpremultiply(src[1], scale);
+                dst[B] = unpremultiply(src[0], scale);
+            }
+            dst[3] = alpha;
+        }
+    }
+
+#if DULLAHAN_PIXEL_KERNELS_X86
+    void copyRowSSE2(unsigned char* dst, const unsigned char* src, size_t bytes, bool streaming)
+    {
+        if (streaming)
+        {
+            // streaming stores need an aligned destination so do the first few bytes by hand
+            size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+            head = head < bytes ? head : bytes;
+            memcpy(dst, src, head);
+            dst += head;
+            src += head;
+            bytes -= head;
+
+            for (; bytes >= 64; bytes -= 64, dst += 64, src += 64)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i*)(src + 0));
+                __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+                __m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+                __m128i d = _mm_loadu_si128((const __m128i*)(src + 48));
+                _mm_stream_si128((__m128i*)(dst + 0), a);
+                _mm_stream_si128((__m128i*)(dst + 16), b);
+                _mm_stream_si128((__m128i*)(dst + 32), c);
+                _mm_stream_si128((__m128i*)(dst + 48), d);
+            }
+            for (; bytes >= 16; bytes -= 16, dst += 16, src += 16)
+            {
+                _mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+            }
+        }
+        else
+        {
+            for (; bytes >= 64; bytes -= 64, dst += 64, src += 64)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i*)(src + 0));
+                __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+                __m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+                __m128i d = _mm_loadu_si128((const __m128i*)(src + 48));
+                _mm_storeu_si128((__m128i*)(dst + 0), a);
+                _mm_storeu_si128((__m128i*)(dst + 16), b);
+                _mm_storeu_si128((__m128i*)(dst + 32), c);
+                _mm_storeu_si128((__m128i*)(dst + 48), d);
+            }
+            for (; bytes >= 16; bytes -= 16, dst += 16, src += 16)
+            {
+                _mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+            }
+        }
+
+        memcpy(dst, src, bytes);
+    }
+
+    DULLAHAN_TARGET_AVX2
+    void copyRowAVX2(unsigned char* dst, const unsigned char* src, size_t bytes, bool streaming)
+    {
+        if (streaming)
+        {
+            size_t head = (32 - ((uintptr_t)dst & 31)) & 31;
+            head = head < bytes ? head : bytes;
+            memcpy(dst, src, head);
+            dst += head;
+            src += head;
+            bytes -= head;
+
+            for (; bytes >= 128; bytes -= 128, dst += 128, src += 128)
+            {
+                __m256i a = _mm256_loadu_si256((const __m256i*)(src + 0));
+                __m256i b = _mm256_loadu_si256((const __m256i*)(src + 32));
+                __m256i c = _mm256_loadu_si256((const __m256i*)(src + 64));
+                __m256i d = _mm256_loadu_si256((const __m256i*)(src + 96));
+                _mm256_stream_si256((__m256i*)(dst + 0), a);
+                _mm256_stream_si256((__m256i*)(dst + 32), b);
+                _mm256_stream_si256((__m256i*)(dst + 64), c);
+                _mm256_stream_si256((__m256i*)(dst + 96), d);
+            }
+            for (; bytes >= 32; bytes -= 32, dst += 32, src += 32)
+            {
+                _mm256_stream_si256((__m256i*)dst, _mm256_loadu_si256((const __m256i*)src));
+            }
+        }
+        else
+        {
+            for (; bytes >= 128; bytes -= 128, dst += 128, src += 128)
+            {
+                __m256i a = _mm256_loadu_si256((const __m256i*)(src + 0));
+                __m256i b = _mm256_loadu_si256((const __m256i*)(src + 32));
+                __m256i c = _mm256_loadu_si256((const __m256i*)(src + 64));
+                __m256i d = _mm256_loadu_si256((const __m256i*)(src + 96));
+                _mm256_storeu_si256((__m256i*)(dst + 0), a);
+                _mm256_storeu_si256((__m256i*)(dst + 32), b);
+                _mm256_storeu_si256((__m256i*)(dst + 64), c);
+                _mm256_storeu_si256((__m256i*)(dst + 96), d);
+            }
+            for (; bytes >= 32; bytes -= 32, dst += 32, src += 32)
+            {
+                _mm256_storeu_si256((__m256i*)dst, _mm256_loadu_si256((const __m256i*)src));
+            }
+        }
+
+        memcpy(dst, src, bytes);
+    }
+
+    void convertRowXRGBSSE2(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+        for (; pixels >= 4; pixels -= 4, dst += 16, src += 16)
+        {
+            _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_loadu_si128((const __m128i*)src), alpha));
+        }
+
+        convertRowXRGBScalar(dst, src, pixels);
+    }
+
+    DULLAHAN_TARGET_SSSE3
+    void convertRowRGBASSSE3(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; pixels >= 4; pixels -= 4, dst += 16, src += 16)
+        {
+            _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), shuffle));
+        }
+
+        convertRowRGBAScalar(dst, src, pixels);
+    }
+
+    DULLAHAN_TARGET_SSSE3
+    void convertRowRGB24SSSE3(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        // 4 pixels in gives 12 bytes out - the 16 byte store spills 4 bytes past that
+        // which the next store overwrites so stop while there are still pixels left
+        const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        for (; pixels >= 6; pixels -= 4, dst += 12, src += 16)
+        {
+            _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), shuffle));
+        }
+
+        convertRowRGB24Scalar(dst, src, pixels);
+    }
+
+    DULLAHAN_TARGET_AVX2
+    void convertRowRGBAAVX2(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        // the byte shuffle works within each 128 bit lane which is all we need here
+        const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                                 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; pixels >= 8; pixels -= 8, dst += 32, src += 32)
+        {
+            _mm256_storeu_si256((__m256i*)dst, _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)src), shuffle));
+        }
+
+        convertRowRGBAScalar(dst, src, pixels);
+    }
+
+    DULLAHAN_TARGET_AVX2
+    void convertRowXRGBAVX2(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+        for (; pixels >= 8; pixels -= 8, dst += 32, src += 32)
+        {
+            _mm256_storeu_si256((__m256i*)dst, _mm256_or_si256(_mm256_loadu_si256((const __m256i*)src), alpha));
+        }
+
+        convertRowXRGBScalar(dst, src, pixels);
+    }
+
+    DULLAHAN_TARGET_SSE42
+    uint64_t hashRowSSE42(uint64_t hash, const unsigned char* src, size_t bytes)
+    {
+        uint32_t a = (uint32_t)hash;
+        uint32_t b = (uint32_t)(hash >> 32);
+
+#if defined(_M_X64) || defined(__x86_64__)
+        for (; bytes >= 16; bytes -= 16, src += 16)
+        {
+            uint64_t words[2];
+            memcpy(words, src, sizeof(words));
+            a = (uint32_t)_mm_crc32_u64(a, words[0]);
+            b = (uint32_t)_mm_crc32_u64(b, words[1]);
+        }
+#endif
+        for (; bytes >= 8; bytes -= 8, src += 8)
+        {
+            uint32_t words[2];
+            memcpy(words, src, sizeof(words));
+            a = _mm_crc32_u32(a, words[0]);
+            b = _mm_crc32_u32(b, words[1]);
+        }
+        for (; bytes > 0; --bytes, ++src)
+        {
+            a = _mm_crc32_u8(a, *src);
+        }
+
+        return ((uint64_t)b << 32) | a;
+    }
+
+    struct cpu_features
+    {
+        bool sse2 = false;
+        bool ssse3 = false;
+        bool sse42 = false;
+        bool avx2 = false;
+    };
+
+    cpu_features detectCPUFeatures()
+    {
+        cpu_features features;
+#ifdef _MSC_VER
+        int regs[4];
+        __cpuid(regs, 0);
+        const int max_leaf = regs[0];
+
+        __cpuid(regs, 1);
+        features.sse2 = (regs[3] & (1 << 26)) != 0;
+        features.ssse3 = (regs[2] & (1 << 9)) != 0;
+        features.sse42 = (regs[2] & (1 << 20)) != 0;
+
+        // AVX2 also needs the OS to save the YMM registers on a context switch
+        const bool os_saves_ymm = (regs[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+        if (max_leaf >= 7 && os_saves_ymm)
+        {
+            __cpuidex(regs, 7, 0);
+            features.avx2 = (regs[1] & (1 << 5)) != 0;
+        }
+#else
+        __builtin_cpu_init();
+        features.sse2 = __builtin_cpu_supports("sse2");
+        features.ssse3 = __builtin_cpu_supports("ssse3");
+        features.sse42 = __builtin_cpu_supports("sse4.2");
+        features.avx2 = __builtin_cpu_supports("avx2");
+#endif
+        return features;
+    }
+#endif // DULLAHAN_PIXEL_KERNELS_X86
+
+#if DULLAHAN_PIXEL_KERNELS_NEON
+    // NEON has no non-temporal store we can reach from intrinsics so streaming is ignored
+    void copyRowNEON(unsigned char* dst, const unsigned char* src, size_t bytes, bool /*streaming*/)
+    {
+        for (; bytes >= 64; bytes -= 64, dst += 64, src += 64)
+        {
+            uint8x16_t a = vld1q_u8(src + 0);
+            uint8x16_t b = vld1q_u8(src + 16);
+            uint8x16_t c = vld1q_u8(src + 32);
+            uint8x16_t d = vld1q_u8(src + 48);
+            vst1q_u8(dst + 0, a);
+            vst1q_u8(dst + 16, b);
+            vst1q_u8(dst + 32, c);
+            vst1q_u8(dst + 48, d);
+        }
+        for (; bytes >= 16; bytes -= 16, dst += 16, src += 16)
+        {
+            vst1q_u8(dst, vld1q_u8(src));
+        }
+
+        memcpy(dst, src, bytes);
+    }
+
+    void convertRowRGBANEON(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        // de-interleaving load/store does the swizzle for us
+        for (; pixels >= 16; pixels -= 16, dst += 64, src += 64)
+        {
+            uint8x16x4_t bgra = vld4q_u8(src);
+            uint8x16_t b = bgra.val[0];
+            bgra.val[0] = bgra.val[2];
+            bgra.val[2] = b;
+            vst4q_u8(dst, bgra);
+        }
+
+        convertRowRGBAScalar(dst, src, pixels);
+    }
+
+    void convertRowXRGBNEON(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        for (; pixels >= 16; pixels -= 16, dst += 64, src += 64)
+        {
+            uint8x16x4_t bgra = vld4q_u8(src);
+            bgra.val[3] = vdupq_n_u8(0xff);
+            vst4q_u8(dst, bgra);
+        }
+
+        convertRowXRGBScalar(dst, src, pixels);
+    }
+
+    void convertRowRGB24NEON(unsigned char* dst, const unsigned char* src, int pixels)
+    {
+        for (; pixels >= 16; pixels -= 16, dst += 48, src += 64)
+        {
+            uint8x16x4_t bgra = vld4q_u8(src);
+            uint8x16x3_t rgb;
+            rgb.val[0] = bgra.val[2];
+            rgb.val[1] = bgra.val[1];
+            rgb.val[2] = bgra.val[0];
+            vst3q_u8(dst, rgb);
+        }
+
+        convertRowRGB24Scalar(dst, src, pixels);
+    }
+
+#if DULLAHAN_PIXEL_KERNELS_ARM_CRC
+    uint64_t hashRowARMCRC(uint64_t hash, const unsigned char* src, size_t bytes)
+    {
+        uint32_t a = (uint32_t)hash;
+        uint32_t b = (uint32_t)(hash >> 32);
+
+        for (; bytes >= 16; bytes -= 16, src += 16)
+        {
+            uint64_t words[2];
+            memcpy(words, src, sizeof(words));
+            a = __crc32cd(a, words[0]);
+            b = __crc32cd(b, words[1]);
+        }
+        for (; bytes > 0; --bytes, ++src)
+        {
+            a = __crc32cb(a, *src);
+        }
+
+        return ((uint64_t)b << 32) | a;
+    }
+#endif
+#endif // DULLAHAN_PIXEL_KERNELS_NEON
+
+    kernel_table selectKernels()
+    {
+        kernel_table table;
+        table.copy_row = copyRowScalar;
+        table.convert_row[dullahan::PF_BGRA] = convertRowBGRAScalar;
+        table.convert_row[dullahan::PF_RGBA] = convertRowRGBAScalar;
+        table.convert_row[dullahan::PF_BGRA_STRAIGHT] = convertRowStraightScalar<2, 0>;
+        table.convert_row[dullahan::PF_RGBA_STRAIGHT] = convertRowStraightScalar<0, 2>;
+        table.convert_row[dullahan::PF_XRGB] = convertRowXRGBScalar;
+        table.convert_row[dullahan::PF_RGB24] = convertRowRGB24Scalar;
+        table.hash_row = hashRowScalar;
+        table.needs_fence = false;
+        table.name = "scalar";
+
+#if DULLAHAN_PIXEL_KERNELS_X86
+        const cpu_features features = detectCPUFeatures();
+        if (features.sse2)
+        {
+            table.copy_row = copyRowSSE2;
+            table.convert_row[dullahan::PF_XRGB] = convertRowXRGBSSE2;
+            table.needs_fence = true;
+            table.name = "SSE2";
+        }
+        if (features.ssse3)
+        {
+            table.convert_row[dullahan::PF_RGBA] = convertRowRGBASSSE3;
+            table.convert_row[dullahan::PF_RGB24] = convertRowRGB24SSSE3;
+            table.name = "SSSE3";
+        }
+        if (features.sse42)
+        {
+            table.hash_row = hashRowSSE42;
+        }
+        if (features.avx2)
+        {
+            // no 256 bit version of the RGB24 packing - the cross lane shuffles
+            // it needs cost more than they save so that stays on SSSE3
+            table.copy_row = copyRowAVX2;
+            table.convert_row[dullahan::PF_RGBA] = convertRowRGBAAVX2;
+            table.convert_row[dullahan::PF_XRGB] = convertRowXRGBAVX2;
+            table.name = "AVX2";
+        }
+#elif DULLAHAN_PIXEL_KERNELS_NEON
+        // always present on the ARM platforms we build for
+        table.copy_row = copyRowNEON;
+        table.convert_row[dullahan::PF_RGBA] = convertRowRGBANEON;
+        table.convert_row[dullahan::PF_XRGB] = convertRowXRGBNEON;
+        table.convert_row[dullahan::PF_RGB24] = convertRowRGB24NEON;
+#if DULLAHAN_PIXEL_KERNELS_ARM_CRC
+        table.hash_row = hashRowARMCRC;
+#endif
+        table.name = "NEON";
+#endif
+
+        return table;
+    }
+
+    const kernel_table& getKernels()
+    {
+        // picked once, the first time we need it (thread safe as of C++11)
+        static const kernel_table table = selectKernels();
+        return table;
+    }
+}
+
+void dullahan_pixel_kernels::copyRows(unsigned char* dst, ptrdiff_t dst_stride,
+                                      const unsigned char* src, ptrdiff_t src_stride,
+                                      size_t row_bytes, int rows)
+{
+    const kernel_table& kernels = getKernels();
+
+    const bool streaming = row_bytes * rows >= NON_TEMPORAL_THRESHOLD;
+
+    for (int row = 0; row < rows; ++row)
+    {
+        kernels.copy_row(dst, src, row_bytes, streaming);
+        dst += dst_stride;
+        src += src_stride;
+    }
+
+#if DULLAHAN_PIXEL_KERNELS_X86
+    // make sure the streamed writes are visible before anyone reads the buffer
+    if (streaming && kernels.needs_fence)
+    {
+        _mm_sfence();
+    }
+#endif
+}
+
+void dullahan_pixel_kernels::convertRows(unsigned char* dst, ptrdiff_t dst_stride,
+                                         const unsigned char* src, ptrdiff_t src_stride,
+                                         int pixels, int rows, dullahan::EPixelFormat format)
+{
+    // no conversion needed so take the faster (possibly streaming) copy
+    if (format == dullahan::PF_BGRA)
+    {
+        copyRows(dst, dst_stride, src, src_stride, pixels * 4, rows);
+        return;
+    }
+
+    const convert_row_func convert_row = getKernels().convert_row[format];
+    for (int row = 0; row < rows; ++row)
+    {
+        convert_row(dst, src, pixels);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+uint64_t dullahan_pixel_kernels::hashRows(const unsigned char* src, ptrdiff_t src_stride,
+                                          size_t row_bytes, int rows)
+{
+    const hash_row_func hash_row = getKernels().hash_row;
+
+    uint64_t hash = ~0ull;
+    for (int row = 0; row < rows; ++row)
+    {
+        hash = hash_row(hash, src, row_bytes);
+        src += src_stride;
+    }
+
+    return hash;
+}
+
+void dullahan_pixel_kernels::compressPixels(const unsigned char* src, ptrdiff_t src_stride,
+                                            int pixels, int rows, int depth,
+                                            std::vector<unsigned char>& compressed)
+{
+    compressed.clear();
+
+    for (int row = 0; row < rows; ++row, src += src_stride)
+    {
+        int i = 0;
+        while (i < pixels)
+        {
+            // a run is only worth it for three or more of the same pixel
+            int end = i + 1;
+            while (end < pixels && end - i < RLE_MAX_COUNT && memcmp(src + end * depth, src + i * depth, depth) == 0)
+            {
+                ++end;
+            }
+
+            unsigned int header;
+            int count;
+            if (end - i >= 3)
+            {
+                count = end - i;
+                header = RLE_RUN_FLAG | count;
+            }
+            else
+            {
+                end = i;
+                while (end < pixels && end - i < RLE_MAX_COUNT)
+                {
+                    if (end + 2 < pixels &&
+                        memcmp(src + end * depth, src + (end + 1) * depth, depth) == 0 &&
+                        memcmp(src + end * depth, src + (end + 2) * depth, depth) == 0)
+                    {
+                        break;
+                    }
+                    ++end;
+                }
+                count = end - i;
+                header = count;
+            }
+
+            compressed.push_back((unsigned char)(header & 0xff));
+            compressed.push_back((unsigned char)(header >> 8));
+
+            const int stored = (header & RLE_RUN_FLAG) ? 1 : count;
+            compressed.insert(compressed.end(), src + i * depth, src + (i + stored) * depth);
+
+            i += count;
+        }
+    }
+}
+
+bool dullahan_pixel_kernels::decompressPixels(const std::vector<unsigned char>& compressed,
+                                              unsigned char* dst, ptrdiff_t dst_stride,
+                                              int pixels, int rows, int depth)
+{
+    const unsigned char* in = compressed.data();
+    const unsigned char* in_end = in + compressed.size();
+
+    for (int row = 0; row < rows; ++row, dst += dst_stride)
+    {
+        int i = 0;
+        while (i < pixels)
+        {
+            if (in_end - in < 2)
+            {
+                return false;
+            }
+            const unsigned int header = in[0] | (in[1] << 8);
+            in += 2;
+
+            const int count = header & RLE_MAX_COUNT;
+            const bool run = (header & RLE_RUN_FLAG) != 0;
+            const ptrdiff_t stored = (ptrdiff_t)(run ? 1 : count) * depth;
+            if (count == 0 || i + count > pixels || in_end - in < stored)
+            {
+                return false;
+            }
+
+            if (run)
+            {
+                for (int j = 0; j < count; ++j)
+                {
+                    memcpy(dst + (i + j) * depth, in, depth);
+                }
+            }
+            else
+            {
+                memcpy(dst + i * depth, in, stored);
+            }
+
+            in += stored;
+            i += count;
+        }
+    }
+
+    return in == in_end;
+}
+
+int dullahan_pixel_kernels::getPixelDepth(dullahan::EPixelFormat format)
+{
+    return format == dullahan::PF_RGB24 ? 3 : 4;
+}
+
+const char* dullahan_pixel_kernels::getKernelName()
+{
+    return getKernels().name;
+}
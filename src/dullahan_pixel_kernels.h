@@ -0,0 +1,79 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef _DULLAHAN_PIXEL_KERNELS
+#define _DULLAHAN_PIXEL_KERNELS
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dullahan.h"
+
+// Low level routines that move pixels between CEF's buffers and ours. Each one
+// has a plain C++ version plus SSE2/AVX2 (x86) or NEON (ARM) versions and the
+// best one the CPU supports is picked the first time they are used.
+namespace dullahan_pixel_kernels
+{
+    // copy a block of rows from src to dst in a single pass. Strides are in bytes and
+    // may be negative - passing a pointer to the last destination row along with a
+    // negative dst_stride writes the rows flipped in Y direction. Large blocks are
+    // written with non-temporal stores so they don't evict everything else from cache
+    void copyRows(unsigned char* dst, ptrdiff_t dst_stride,
+                  const unsigned char* src, ptrdiff_t src_stride,
+                  size_t row_bytes, int rows);
+
+    // same as copyRows(..) but converts CEF's premultiplied BGRA pixels to the
+    // given output format on the way through - pixels is the width of a row
+    void convertRows(unsigned char* dst, ptrdiff_t dst_stride,
+                     const unsigned char* src, ptrdiff_t src_stride,
+                     int pixels, int rows, dullahan::EPixelFormat format);
+
+    // hash a block of rows - used to tell if part of the page really changed between
+    // paints. Values are only comparable with others from the same process since the
+    // hash function used depends on the CPU
+    uint64_t hashRows(const unsigned char* src, ptrdiff_t src_stride,
+                      size_t row_bytes, int rows);
+
+    // run length encode a block of pixels - used to keep snapshots of pages that
+    // aren't running. Pages are mostly flat colour so this shrinks them a lot
+    void compressPixels(const unsigned char* src, ptrdiff_t src_stride,
+                        int pixels, int rows, int depth,
+                        std::vector<unsigned char>& compressed);
+
+    // undo compressPixels(..) - returns false if the data doesn't fit the block
+    bool decompressPixels(const std::vector<unsigned char>& compressed,
+                          unsigned char* dst, ptrdiff_t dst_stride,
+                          int pixels, int rows, int depth);
+
+    // bytes per pixel for a given output format
+    int getPixelDepth(dullahan::EPixelFormat format);
+
+    // name of the instruction set the kernels are using - for logging
+    const char* getKernelName();
+}
+
+#endif // _DULLAHAN_PIXEL_KERNELS
@@ -0,0 +1,417 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include "dullahan_profile_pool.h"
+#include "dullahan_debug.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// in each profile - held for as long as it is leased and touched when it
+// is leased and given back so its time says when it was last used
+const char* const LEASE_LOCK_NAME = "dullahan_profile.lock";
+
+// in the base path - held briefly while a profile is leased or the pool is
+// trimmed so one process never throws away a profile another is taking
+const char* const POOL_LOCK_NAME = "dullahan_pool.lock";
+
+const char* const PROFILE_PREFIX = "profile_";
+
+const int MAX_POOL_LOCK_WAIT_MS = 5000;
+
+struct profile_info
+{
+    std::filesystem::path path;
+    std::filesystem::file_time_type last_used;
+    int64_t size = 0;
+};
+
+// everything under base_path that looks like one of our profiles
+std::vector<profile_info> listProfiles(const std::filesystem::path& base_path)
+{
+    std::vector<profile_info> profiles;
+
+    std::error_code ec;
+    for (std::filesystem::directory_iterator iter(base_path, ec), end; !ec && iter != end; iter.increment(ec))
+    {
+        const std::string name = iter->path().filename().string();
+        if (!iter->is_directory(ec) || name.compare(0, strlen(PROFILE_PREFIX), PROFILE_PREFIX) != 0)
+        {
+            continue;
+        }
+
+        profile_info profile;
+        profile.path = iter->path();
+
+        std::error_code time_ec;
+        profile.last_used = std::filesystem::last_write_time(profile.path / LEASE_LOCK_NAME, time_ec);
+        if (time_ec)
+        {
+            profile.last_used = std::filesystem::last_write_time(profile.path, time_ec);
+        }
+
+        profiles.push_back(profile);
+    }
+
+    return profiles;
+}
+
+int64_t getDirectorySize(const std::filesystem::path& path)
+{
+    int64_t size = 0;
+
+    std::error_code ec;
+    const auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (std::filesystem::recursive_directory_iterator iter(path, options, ec), end; !ec && iter != end; iter.increment(ec))
+    {
+        std::error_code size_ec;
+        if (iter->is_regular_file(size_ec))
+        {
+            const uintmax_t file_size = iter->file_size(size_ec);
+            if (!size_ec)
+            {
+                size += static_cast<int64_t>(file_size);
+            }
+        }
+    }
+
+    return size;
+}
+}
+
+// An exclusive lock on a file that goes away with the process holding it -
+// flock(..) on Linux and macOS and LockFileEx(..) on Windows
+class dullahan_profile_pool::lock_file
+{
+    public:
+        ~lock_file()
+        {
+            unlock();
+        }
+
+        bool tryLock(const std::filesystem::path& path)
+        {
+            unlock();
+
+#ifdef WIN32
+            HANDLE handle = CreateFileW(path.wstring().c_str(), GENERIC_READ | GENERIC_WRITE,
+                                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                        nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+
+            OVERLAPPED overlapped = {};
+            if (!LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped))
+            {
+                CloseHandle(handle);
+                return false;
+            }
+            mHandle = handle;
+#else
+            int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                return false;
+            }
+
+            if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+            {
+                close(fd);
+                return false;
+            }
+            mFd = fd;
+#endif
+            return true;
+        }
+
+        // keep trying until max_wait_ms has gone by
+        bool lock(const std::filesystem::path& path, int max_wait_ms)
+        {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(max_wait_ms);
+            while (!tryLock(path))
+            {
+                if (std::chrono::steady_clock::now() >= deadline)
+                {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            return true;
+        }
+
+        // write the time into the file - which also makes it the file's time
+        void touch()
+        {
+            const std::string stamp = std::to_string(static_cast<int64_t>(time(nullptr))) + "\n";
+#ifdef WIN32
+            if (mHandle != INVALID_HANDLE_VALUE)
+            {
+                DWORD written = 0;
+                SetFilePointer(mHandle, 0, nullptr, FILE_BEGIN);
+                WriteFile(mHandle, stamp.data(), static_cast<DWORD>(stamp.size()), &written, nullptr);
+                SetEndOfFile(mHandle);
+            }
+#else
+            if (mFd != -1 && ftruncate(mFd, 0) == 0)
+            {
+                (void)!pwrite(mFd, stamp.data(), stamp.size(), 0);
+            }
+#endif
+        }
+
+        void unlock()
+        {
+#ifdef WIN32
+            if (mHandle != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(mHandle);
+                mHandle = INVALID_HANDLE_VALUE;
+            }
+#else
+            if (mFd != -1)
+            {
+                close(mFd);
+                mFd = -1;
+            }
+#endif
+        }
+
+    private:
+#ifdef WIN32
+        HANDLE mHandle = INVALID_HANDLE_VALUE;
+#else
+        int mFd = -1;
+#endif
+};
+
+dullahan_profile_pool::dullahan_profile_pool() :
+    mMaxProfiles(0),
+    mMaxSizeBytes(0),
+    mMaxUnusedDays(0),
+    mStopCollecting(false)
+{
+}
+
+dullahan_profile_pool::~dullahan_profile_pool()
+{
+    release();
+}
+
+void dullahan_profile_pool::init(const std::string& base_path, int max_profiles, int64_t max_size_mb, int max_unused_days)
+{
+    // CEF wants absolute paths
+    std::error_code ec;
+    mBasePath = std::filesystem::absolute(base_path, ec);
+    if (ec)
+    {
+        mBasePath = base_path;
+    }
+
+    mMaxProfiles = std::max(max_profiles, 0);
+    mMaxSizeBytes = std::max<int64_t>(max_size_mb, 0) * 1024 * 1024;
+    mMaxUnusedDays = std::max(max_unused_days, 0);
+}
+
+// The warmest free profile, or a new one if they are all in use
+std::string dullahan_profile_pool::lease()
+{
+    if (mLease)
+    {
+        return mLeasedPath.string();
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(mBasePath, ec);
+
+    lock_file pool_lock;
+    if (!pool_lock.lock(mBasePath / POOL_LOCK_NAME, MAX_POOL_LOCK_WAIT_MS))
+    {
+        DLNOUT("Unable to lock profile pool in " << mBasePath.string());
+        return std::string();
+    }
+
+    std::vector<profile_info> profiles = listProfiles(mBasePath);
+    std::sort(profiles.begin(), profiles.end(), [](const profile_info& a, const profile_info& b)
+    {
+        return a.last_used > b.last_used;
+    });
+
+    std::unique_ptr<lock_file> lease(new lock_file);
+    for (size_t i = 0; i < profiles.size(); ++i)
+    {
+        if (lease->tryLock(profiles[i].path / LEASE_LOCK_NAME))
+        {
+            mLeasedPath = profiles[i].path;
+            break;
+        }
+    }
+
+    if (mLeasedPath.empty())
+    {
+        std::filesystem::path path;
+        for (int i = 0; path.empty() || std::filesystem::exists(path, ec); ++i)
+        {
+            path = mBasePath / (PROFILE_PREFIX + std::to_string(i));
+        }
+
+        if (!std::filesystem::create_directories(path, ec) || !lease->tryLock(path / LEASE_LOCK_NAME))
+        {
+            DLNOUT("Unable to create profile " << path.string());
+            return std::string();
+        }
+        mLeasedPath = path;
+    }
+
+    lease->touch();
+    mLease = std::move(lease);
+
+    DLNOUT("Leased profile " << mLeasedPath.string());
+    return mLeasedPath.string();
+}
+
+void dullahan_profile_pool::release()
+{
+    stopCollecting();
+
+    if (mLease)
+    {
+        // most recently used from now on - next launch gets it first
+        mLease->touch();
+        mLease.reset();
+        mLeasedPath.clear();
+    }
+}
+
+void dullahan_profile_pool::collectGarbageAsync()
+{
+    stopCollecting();
+
+    mStopCollecting = false;
+    mCollector = std::thread(&dullahan_profile_pool::collectGarbage, this);
+}
+
+void dullahan_profile_pool::stopCollecting()
+{
+    mStopCollecting = true;
+    if (mCollector.joinable())
+    {
+        mCollector.join();
+    }
+}
+
+// Oldest first, free profiles are deleted while they have been unused for too long
+// or the pool has too many of them or is too big. Sizing them all up can take a
+// while so it is done without holding anything - other processes can lease in the
+// meantime. The pool lock is only taken to check a profile is still free (nobody
+// has its lock) and delete it, so nobody can lease it while it goes
+void dullahan_profile_pool::collectGarbage()
+{
+    std::vector<profile_info> free_profiles;
+
+    std::vector<profile_info> profiles = listProfiles(mBasePath);
+    int64_t total_size = 0;
+    for (size_t i = 0; i < profiles.size() && !mStopCollecting; ++i)
+    {
+        profiles[i].size = getDirectorySize(profiles[i].path);
+        total_size += profiles[i].size;
+
+        if (profiles[i].path == mLeasedPath)
+        {
+            continue;
+        }
+
+        lock_file lock;
+        if (lock.tryLock(profiles[i].path / LEASE_LOCK_NAME))
+        {
+            free_profiles.push_back(profiles[i]);
+        }
+    }
+
+    std::sort(free_profiles.begin(), free_profiles.end(), [](const profile_info& a, const profile_info& b)
+    {
+        return a.last_used < b.last_used;
+    });
+
+    const auto stale_time = std::filesystem::file_time_type::clock::now() - std::chrono::hours(24 * mMaxUnusedDays);
+    size_t num_profiles = profiles.size();
+
+    for (size_t i = 0; i < free_profiles.size() && !mStopCollecting; ++i)
+    {
+        const profile_info& profile = free_profiles[i];
+
+        const bool stale = mMaxUnusedDays > 0 && profile.last_used < stale_time;
+        const bool too_many = mMaxProfiles > 0 && num_profiles > static_cast<size_t>(mMaxProfiles);
+        const bool too_big = mMaxSizeBytes > 0 && total_size > mMaxSizeBytes;
+        if (!stale && !too_many && !too_big)
+        {
+            continue;
+        }
+
+        lock_file pool_lock;
+        if (!pool_lock.lock(mBasePath / POOL_LOCK_NAME, MAX_POOL_LOCK_WAIT_MS))
+        {
+            return;
+        }
+
+        // somebody may have leased it since we looked
+        lock_file lease_lock;
+        if (!lease_lock.tryLock(profile.path / LEASE_LOCK_NAME))
+        {
+            continue;
+        }
+
+        // the lock file can't be deleted on Windows while we have it open
+        lease_lock.unlock();
+
+        std::error_code ec;
+        std::filesystem::remove_all(profile.path, ec);
+        if (ec)
+        {
+            DLNOUT("Unable to remove profile " << profile.path.string() << " - " << ec.message());
+            continue;
+        }
+
+        DLNOUT("Removed profile " << profile.path.string() << " (" << profile.size << " bytes)");
+        --num_profiles;
+        total_size -= profile.size;
+    }
+}
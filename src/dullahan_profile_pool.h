@@ -0,0 +1,79 @@
+/*
+    @brief Dullahan - a headless browser rendering engine
+           based around the Chromium Embedded Framework
+    @author Callum Prentice 2017
+
+    Copyright (c) 2017, Linden Research, Inc.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef _DULLAHAN_PROFILE_POOL
+#define _DULLAHAN_PROFILE_POOL
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Profile (root_cache_path) directories kept under one base path and reused from one
+// launch to the next. CEF won't let two instances share a profile so each one in use
+// holds a lock file - the operating system drops it if the process dies - and a new
+// instance gets the most recently used free one, whose HTTP cache is still warm.
+// Profiles nobody is using are thrown away once there are too many of them, they
+// take up too much space or they haven't been used for too long.
+class dullahan_profile_pool
+{
+    public:
+        dullahan_profile_pool();
+        ~dullahan_profile_pool();
+
+        // max_profiles and max_size_mb (for all of them together) of 0 mean no limit
+        void init(const std::string& base_path, int max_profiles, int64_t max_size_mb, int max_unused_days);
+
+        // the directory of the profile we now have - empty if the base path can't be
+        // written to. It stays ours until release() or the process goes away
+        std::string lease();
+        void release();
+
+        // trim the pool on a thread of its own - profiles in use are never touched.
+        // release() stops it early if it is still going
+        void collectGarbageAsync();
+
+    private:
+        class lock_file;
+
+        void collectGarbage();
+        void stopCollecting();
+
+        std::filesystem::path mBasePath;
+        int mMaxProfiles;
+        int64_t mMaxSizeBytes;
+        int mMaxUnusedDays;
+
+        std::unique_ptr<lock_file> mLease;
+        std::filesystem::path mLeasedPath;
+
+        std::thread mCollector;
+        std::atomic<bool> mStopCollecting;
+};
+
+#endif // _DULLAHAN_PROFILE_POOL
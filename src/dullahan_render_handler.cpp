@@ -32,6 +32,94 @@
 
 #include "dullahan_impl.h"
 #include "dullahan_callback_manager.h"
+#include "dullahan_frame_exchange.h"
+#include "dullahan_pixel_kernels.h"
+
+#include <algorithm>
+
+namespace
+{
+    // beyond this many separate regions, it's cheaper for the consumer to
+    // upload the bounding box than to issue lots of small uploads
+    const size_t MAX_DIRTY_RECTS = 8;
+
+    // size of the squares we hash the page in to look for changes
+    const int TILE_SIZE = 64;
+
+    // what we found out about each tile during a paint
+    const unsigned char TILE_UNTOUCHED = 0;
+    const unsigned char TILE_UNCHANGED = 1;
+    const unsigned char TILE_CHANGED = 2;
+
+    // number of frames we remember the damage for - consumers further
+    // behind than this get the whole page marked as changed
+    const uint64_t DAMAGE_HISTORY_SIZE = 32;
+
+    int rectArea(const CefRect& rect)
+    {
+        return rect.width * rect.height;
+    }
+
+    CefRect unionRect(const CefRect& a, const CefRect& b)
+    {
+        const int x = std::min(a.x, b.x);
+        const int y = std::min(a.y, b.y);
+        const int right = std::max(a.x + a.width, b.x + b.width);
+        const int bottom = std::max(a.y + a.height, b.y + b.height);
+        return CefRect(x, y, right - x, bottom - y);
+    }
+
+    // replace a list of regions with the single one that covers them all
+    void collapseToBounds(std::vector<dullahan::dullahan_rect>& rects)
+    {
+        if (rects.size() < 2)
+        {
+            return;
+        }
+
+        int left = rects[0].x;
+        int top = rects[0].y;
+        int right = rects[0].x + rects[0].width;
+        int bottom = rects[0].y + rects[0].height;
+        for (size_t i = 1; i < rects.size(); ++i)
+        {
+            left = std::min(left, rects[i].x);
+            top = std::min(top, rects[i].y);
+            right = std::max(right, rects[i].x + rects[i].width);
+            bottom = std::max(bottom, rects[i].y + rects[i].height);
+        }
+
+        rects.resize(1);
+        rects[0].x = left;
+        rects[0].y = top;
+        rects[0].width = right - left;
+        rects[0].height = bottom - top;
+    }
+
+    // the part two rectangles have in common - empty if they don't overlap
+    CefRect intersectRect(const CefRect& a, const CefRect& b)
+    {
+        const int x = std::max(a.x, b.x);
+        const int y = std::max(a.y, b.y);
+        const int right = std::min(a.x + a.width, b.x + b.width);
+        const int bottom = std::min(a.y + a.height, b.y + b.height);
+
+        if (right <= x || bottom <= y)
+        {
+            return CefRect();
+        }
+
+        return CefRect(x, y, right - x, bottom - y);
+    }
+
+    // true if the rectangles overlap or share an edge
+    bool rectsTouch(const CefRect& a, const CefRect& b)
+    {
+        return a.x <= b.x + b.width && b.x <= a.x + a.width &&
+               a.y <= b.y + b.height && b.y <= a.y + a.height;
+    }
+}
+
 
 dullahan_render_handler::dullahan_render_handler(dullahan_impl* parent) :
     mParent(parent)
@@ -39,45 +127,135 @@ dullahan_render_handler::dullahan_render_handler(dullahan_impl* parent) :
     // inidcates if we should flip the pixel buffer in Y direction
     mFlipYPixels = parent->getFlipPixelsY();
 
+    // indicates if we can skip copying pixels when there is no need to flip or composite
+    mZeroCopyFrames = parent->getZeroCopyFrames();
+    mPixelBufferStale = false;
+
+    // indicates if we hash the page to find paints that didn't change anything
+    mSuppressUnchangedFrames = parent->getSuppressUnchangedFrames();
+    mTileHashesValid = false;
+    mTileColumns = 0;
+    mTileRows = 0;
+
+    // set if another thread picks frames up from a triple buffer
+    mFrameExchange = parent->getFrameExchange();
+
+    // frame numbers start at 1 so 0 can mean "never had one"
+    mFrameSequence = 0;
+    mDamageHistory.resize(DAMAGE_HISTORY_SIZE);
+
+    // no snapshot until the browser is discarded
+    mSnapshotWidth = 0;
+    mSnapshotHeight = 0;
+    mSnapshotFormat = dullahan::PF_BGRA;
+
     // the pixel buffer
-    mPixelBuffer = nullptr;
     mPixelBufferWidth = 0;
     mPixelBufferHeight = 0;
+    mPixelBufferReset = false;
+
+    // visible and showing the whole page until we're told otherwise
+    mVisible = true;
+    mMissedPaints = false;
+
+    // where we write pixels - decided once we know the size
+    mTargetPixels = nullptr;
+    mTargetStride = 0;
 
     // the popup buffer
     mPopupBuffer = nullptr;
 
-    // a row in the pixel buffer - used as temp buffer when flipping
-    mPixelBufferRow = nullptr;
+    // depth of the buffers CEF gives us - popup buffer matches it
+    mBufferDepth = parent->getViewDepth();
+
+    // format and depth of the pixel buffer we hand to the consumer
+    mOutputPixelFormat = parent->getPixelFormat();
+    mPixelFormat = mOutputPixelFormat;
+    mPixelDepth = parent->getDepth();
 
-    // depth is same for all buffer
-    mBufferDepth = parent->getDepth();
+    DLNOUT("Pixel copies using " << dullahan_pixel_kernels::getKernelName() << " kernels");
 }
 
 dullahan_render_handler::~dullahan_render_handler()
 {
-    delete[] mPixelBuffer;
-
     delete[] mPopupBuffer;
-
-    delete[] mPixelBufferRow;
 }
 
 void dullahan_render_handler::resizePixelBuffer(int width, int height)
 {
     if (mPixelBufferWidth != width || mPixelBufferHeight != height)
     {
-        delete[] mPixelBuffer;
         mPixelBufferWidth = width;
         mPixelBufferHeight = height;
-        mPixelBuffer = new unsigned char[mPixelBufferWidth * mPixelBufferHeight * mBufferDepth];
-        memset(mPixelBuffer, 0xff, mPixelBufferWidth * mPixelBufferHeight * mBufferDepth);
 
-        delete[] mPixelBufferRow;
-        mPixelBufferRow = new unsigned char[mPixelBufferWidth * mBufferDepth];
+        // give the consumer a chance to swap their buffer for one the page fits in
+        if (mExternalBuffer.pixels != nullptr && !externalBufferFits())
+        {
+            mParent->getCallbackManager()->onPixelBufferResize(width, height);
+        }
+
+        selectPixelTarget();
+
+        // contents are gone so next paint must copy everything
+        mPixelBufferReset = true;
+        mTileHashesValid = false;
+    }
+}
+
+bool dullahan_render_handler::externalBufferFits()
+{
+    return mExternalBuffer.width >= mPixelBufferWidth &&
+           mExternalBuffer.height >= mPixelBufferHeight &&
+           mExternalBuffer.row_pitch >= mExternalBuffer.width * dullahan_pixel_kernels::getPixelDepth(mExternalBuffer.format);
+}
+
+// point mTargetPixels at the consumer's buffer if they gave us one that is big
+// enough, otherwise at our own buffer, (re)creating it if the size changed
+void dullahan_render_handler::selectPixelTarget()
+{
+    if (mExternalBuffer.pixels != nullptr && !externalBufferFits())
+    {
+        DLNOUT("External pixel buffer is too small for " << mPixelBufferWidth << " x " << mPixelBufferHeight << " - using our own");
+        mExternalBuffer = dullahan::dullahan_pixel_buffer();
+    }
+
+    if (mExternalBuffer.pixels != nullptr)
+    {
+        // every pixel goes to the consumer now so we don't need a copy of our own
+        mPixelBuffer.release();
+
+        mPixelFormat = mExternalBuffer.format;
+        mPixelDepth = dullahan_pixel_kernels::getPixelDepth(mPixelFormat);
+        mTargetPixels = mExternalBuffer.pixels;
+        mTargetStride = mExternalBuffer.row_pitch;
+    }
+    else
+    {
+        mPixelFormat = mOutputPixelFormat;
+        mPixelDepth = dullahan_pixel_kernels::getPixelDepth(mPixelFormat);
+
+        // no need to clear it - a new size or buffer means the next paint copies the whole view
+        mPixelBuffer.resize((size_t)mPixelBufferWidth * mPixelBufferHeight * mPixelDepth);
+
+        mTargetPixels = mPixelBuffer.data();
+        mTargetStride = mPixelBufferWidth * mPixelDepth;
     }
 }
 
+void dullahan_render_handler::setExternalBuffer(const dullahan::dullahan_pixel_buffer& buffer)
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    mExternalBuffer = buffer;
+
+    // switch over straight away so we never write into a buffer the consumer has let go of
+    selectPixelTarget();
+
+    // the buffer we write to now doesn't have the page in it
+    mPixelBufferReset = true;
+    mTileHashesValid = false;
+}
+
 // CefRenderHandler override
 void dullahan_render_handler::GetViewRect(CefRefPtr<CefBrowser> browser, CefRect& rect)
 {
@@ -91,17 +269,250 @@ void dullahan_render_handler::GetViewRect(CefRefPtr<CefBrowser> browser, CefRect
     rect = CefRect(0, 0, width, height);
 }
 
+CefRect dullahan_render_handler::clipToView(const CefRect& rect)
+{
+    return intersectRect(rect, CefRect(0, 0, mPixelBufferWidth, mPixelBufferHeight));
+}
+
+// same as clipToView(..) but also drops anything outside the part of the page the
+// consumer told us is visible. That is given in pixel buffer coordinates so it has
+// to be flipped back into view coordinates if we flip the pixels
+CefRect dullahan_render_handler::clipToVisible(const CefRect& rect)
+{
+    const CefRect clipped = clipToView(rect);
+    if (mVisibleRegion.IsEmpty())
+    {
+        return clipped;
+    }
+
+    CefRect visible = mVisibleRegion;
+    if (mFlipYPixels)
+    {
+        visible.y = mPixelBufferHeight - visible.y - visible.height;
+    }
+
+    return intersectRect(clipped, visible);
+}
+
+void dullahan_render_handler::setVisible(bool visible)
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    mVisible = visible;
+}
+
+void dullahan_render_handler::setVisibleRegion(const CefRect& region)
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    mVisibleRegion = region;
+
+    // parts that were hidden may have changed without us copying them
+    mMissedPaints = true;
+}
+
+// Build the list of regions to copy for this paint from the ones CEF gives us.
+// Overlapping or adjacent regions are combined when doing so doesn't pull in
+// many untouched pixels and if there are still too many, we fall back to the
+// bounding box of all of them.
+void dullahan_render_handler::mergeDirtyRects(const RectList& dirty_rects)
+{
+    for (RectList::const_iterator iter = dirty_rects.begin(); iter != dirty_rects.end(); ++iter)
+    {
+        CefRect rect = clipToVisible(*iter);
+        if (!rect.IsEmpty())
+        {
+            mDirtyRects.push_back(rect);
+        }
+    }
+
+    bool merged = true;
+    while (merged && mDirtyRects.size() > 1)
+    {
+        merged = false;
+        for (size_t i = 0; i < mDirtyRects.size() && !merged; ++i)
+        {
+            for (size_t j = i + 1; j < mDirtyRects.size() && !merged; ++j)
+            {
+                if (rectsTouch(mDirtyRects[i], mDirtyRects[j]))
+                {
+                    // only merge if at least 3/4 of the combined area was actually dirty
+                    const CefRect combined = unionRect(mDirtyRects[i], mDirtyRects[j]);
+                    if ((rectArea(mDirtyRects[i]) + rectArea(mDirtyRects[j])) * 4 >= rectArea(combined) * 3)
+                    {
+                        mDirtyRects[i] = combined;
+                        mDirtyRects.erase(mDirtyRects.begin() + j);
+                        merged = true;
+                    }
+                }
+            }
+        }
+    }
+
+    if (mDirtyRects.size() > MAX_DIRTY_RECTS)
+    {
+        CefRect bounds = mDirtyRects[0];
+        for (size_t i = 1; i < mDirtyRects.size(); ++i)
+        {
+            bounds = unionRect(bounds, mDirtyRects[i]);
+        }
+        mDirtyRects.assign(1, bounds);
+    }
+}
+
+// copy a region of the view from the CEF buffer into the pixel buffer - the
+// rows are written straight to their flipped location if flipping is on and
+// converted to the output pixel format as they go
+void dullahan_render_handler::copyViewRect(const unsigned char* src, const CefRect& rect)
+{
+    const ptrdiff_t src_stride = mPixelBufferWidth * mBufferDepth;
+    const ptrdiff_t dst_stride = mTargetStride;
+
+    // flipped rows start at the bottom of the destination and walk upwards
+    const int dst_row = mFlipYPixels ? (mPixelBufferHeight - 1 - rect.y) : rect.y;
+    dullahan_pixel_kernels::convertRows(mTargetPixels + dst_row * dst_stride + rect.x * mPixelDepth,
+                                        mFlipYPixels ? -dst_stride : dst_stride,
+                                        src + rect.y * src_stride + rect.x * mBufferDepth, src_stride,
+                                        rect.width, rect.height, mPixelFormat);
+}
+
 void dullahan_render_handler::copyPopupIntoView()
 {
-    int popup_y = (mFlipYPixels ? (mPixelBufferHeight - mPopupBufferRect.y) : mPopupBufferRect.y);
-    unsigned char* src = (unsigned char*)mPopupBuffer;
-    unsigned char* dst = mPixelBuffer + popup_y * mPixelBufferWidth * mBufferDepth + mPopupBufferRect.x * mBufferDepth;
-    while (src < (unsigned char*)mPopupBuffer + mPopupBufferRect.width * mPopupBufferRect.height * mBufferDepth)
+    // popups can hang off the edge of the view so only copy the part we can see
+    const CefRect visible = clipToView(mPopupBufferRect);
+    if (visible.IsEmpty() || mTargetPixels == nullptr)
     {
-        memcpy(dst, src, mPopupBufferRect.width * mBufferDepth);
-        src += mPopupBufferRect.width * mBufferDepth;
-        dst += mPixelBufferWidth * mBufferDepth * (mFlipYPixels ? -1 : 1);
+        return;
     }
+
+    const ptrdiff_t src_stride = mPopupBufferRect.width * mBufferDepth;
+    const ptrdiff_t dst_stride = mTargetStride;
+
+    const unsigned char* src = mPopupBuffer +
+                               (visible.y - mPopupBufferRect.y) * src_stride +
+                               (visible.x - mPopupBufferRect.x) * mBufferDepth;
+    const int dst_row = mFlipYPixels ? (mPixelBufferHeight - 1 - visible.y) : visible.y;
+    dullahan_pixel_kernels::convertRows(mTargetPixels + dst_row * dst_stride + visible.x * mPixelDepth,
+                                        mFlipYPixels ? -dst_stride : dst_stride,
+                                        src, src_stride,
+                                        visible.width, visible.height, mPixelFormat);
+}
+
+// Hash every tile touched by the regions in mPageDirtyRects and replace them with
+// the tiles whose contents actually changed, joining neighbouring tiles into
+// larger rectangles. Returns false if nothing changed at all.
+bool dullahan_render_handler::findChangedTiles(const unsigned char* pixels, ptrdiff_t stride)
+{
+    const int columns = (mPixelBufferWidth + TILE_SIZE - 1) / TILE_SIZE;
+    const int rows = (mPixelBufferHeight + TILE_SIZE - 1) / TILE_SIZE;
+    if (columns != mTileColumns || rows != mTileRows)
+    {
+        mTileColumns = columns;
+        mTileRows = rows;
+        mTileHashes.assign(columns * rows, 0);
+        mTileState.resize(columns * rows);
+        mTileHashesValid = false;
+    }
+
+    // no hashes to compare against so everything counts as changed
+    if (!mTileHashesValid)
+    {
+        dullahan::dullahan_rect everything;
+        everything.width = mPixelBufferWidth;
+        everything.height = mPixelBufferHeight;
+        mPageDirtyRects.assign(1, everything);
+    }
+
+    std::fill(mTileState.begin(), mTileState.end(), TILE_UNTOUCHED);
+
+    for (size_t i = 0; i < mPageDirtyRects.size(); ++i)
+    {
+        const dullahan::dullahan_rect& rect = mPageDirtyRects[i];
+        const int first_column = rect.x / TILE_SIZE;
+        const int last_column = (rect.x + rect.width - 1) / TILE_SIZE;
+        const int first_row = rect.y / TILE_SIZE;
+        const int last_row = (rect.y + rect.height - 1) / TILE_SIZE;
+
+        for (int row = first_row; row <= last_row; ++row)
+        {
+            for (int column = first_column; column <= last_column; ++column)
+            {
+                const int index = row * mTileColumns + column;
+                if (mTileState[index] != TILE_UNTOUCHED)
+                {
+                    continue;
+                }
+
+                const int x = column * TILE_SIZE;
+                const int y = row * TILE_SIZE;
+                const int width = std::min(TILE_SIZE, mPixelBufferWidth - x);
+                const int height = std::min(TILE_SIZE, mPixelBufferHeight - y);
+                const uint64_t hash = dullahan_pixel_kernels::hashRows(pixels + y * stride + x * mPixelDepth, stride,
+                                                                       width * mPixelDepth, height);
+
+                if (!mTileHashesValid || hash != mTileHashes[index])
+                {
+                    mTileHashes[index] = hash;
+                    mTileState[index] = TILE_CHANGED;
+                }
+                else
+                {
+                    mTileState[index] = TILE_UNCHANGED;
+                }
+            }
+        }
+    }
+    mTileHashesValid = true;
+
+    // runs of changed tiles along each row become a rectangle, which is
+    // stretched downwards if the row below has a run in the same place
+    mPageDirtyRects.clear();
+    for (int row = 0; row < mTileRows; ++row)
+    {
+        int column = 0;
+        while (column < mTileColumns)
+        {
+            if (mTileState[row * mTileColumns + column] != TILE_CHANGED)
+            {
+                ++column;
+                continue;
+            }
+
+            const int start = column;
+            while (column < mTileColumns && mTileState[row * mTileColumns + column] == TILE_CHANGED)
+            {
+                ++column;
+            }
+
+            dullahan::dullahan_rect rect;
+            rect.x = start * TILE_SIZE;
+            rect.y = row * TILE_SIZE;
+            rect.width = std::min(column * TILE_SIZE, mPixelBufferWidth) - rect.x;
+            rect.height = std::min(TILE_SIZE, mPixelBufferHeight - rect.y);
+
+            bool extended = false;
+            for (size_t i = 0; i < mPageDirtyRects.size() && !extended; ++i)
+            {
+                dullahan::dullahan_rect& above = mPageDirtyRects[i];
+                if (above.x == rect.x && above.width == rect.width && above.y + above.height == rect.y)
+                {
+                    above.height += rect.height;
+                    extended = true;
+                }
+            }
+            if (!extended)
+            {
+                mPageDirtyRects.push_back(rect);
+            }
+        }
+    }
+
+    if (mPageDirtyRects.size() > MAX_DIRTY_RECTS)
+    {
+        collapseToBounds(mPageDirtyRects);
+    }
+
+    return !mPageDirtyRects.empty();
 }
 
 // CefRenderHandler override
@@ -113,35 +524,96 @@ void dullahan_render_handler::OnPaint(CefRefPtr<CefBrowser> browser,
 
     CEF_REQUIRE_UI_THREAD();
 
+    mDirtyRects.clear();
+
+    // nobody can see the page so don't spend time copying it - the last frame stays
+    // in our buffer and we catch up with one full copy when it is shown again
+    if (!mVisible)
+    {
+        mMissedPaints = true;
+        return;
+    }
+
+    // the pixels we tell the consumer about - usually the buffer we copy into
+    const unsigned char* page_pixels = mTargetPixels;
+    ptrdiff_t page_stride = mTargetStride;
+
     // whole page was updated
     if (type == PET_VIEW)
     {
         // create (firs time) or resize (browser size changed) a buffer for pixels
-        // and copy them in
         resizePixelBuffer(width, height);
-        memcpy(mPixelBuffer, buffer, width * height * mBufferDepth);
 
-        // we need to flip pixel buffer in Y direction as per settings
-        if (mFlipYPixels)
+        // that may have moved where pixels go
+        page_pixels = mTargetPixels;
+        page_stride = mTargetStride;
+
+        // nothing to flip, convert or composite so the consumer can read from CEF's buffer
+        // directly - unless they gave us a buffer in which case they want the pixels there
+        const bool zero_copy = mZeroCopyFrames && !mFlipYPixels && mPopupBuffer == nullptr &&
+                               mPixelFormat == dullahan::PF_BGRA && mExternalBuffer.pixels == nullptr;
+
+        // work out which parts of the view changed - everything if the buffer was just
+        // created since CEF doesn't know we threw the old contents away. Same if we have
+        // been skipping copies and now need our own buffer to be complete again
+        if (mPixelBufferReset || mMissedPaints || (mPixelBufferStale && !zero_copy))
         {
-            const size_t stride = mPixelBufferWidth * mBufferDepth;
-            unsigned char* lower = mPixelBuffer;
-            unsigned char* upper = mPixelBuffer + (mPixelBufferHeight - 1) * stride;
-            while (lower < upper)
+            const CefRect everything = clipToVisible(CefRect(0, 0, mPixelBufferWidth, mPixelBufferHeight));
+            if (!everything.IsEmpty())
             {
-                memcpy(mPixelBufferRow, lower, stride);
-                memcpy(lower, upper, stride);
-                memcpy(upper, mPixelBufferRow, stride);
-                lower += stride;
-                upper -= stride;
+                mDirtyRects.push_back(everything);
             }
+
+            // A visible region leaves the rest of the page to be copied once it is shown. A
+            // new buffer (or one we stopped filling to hand out CEF's) may have nothing there
+            // yet so it is cleared once rather than handed out with whatever the memory held
+            const bool covers_view = everything.width == mPixelBufferWidth && everything.height == mPixelBufferHeight;
+            if (!zero_copy && !covers_view && (mPixelBufferReset || mPixelBufferStale) && mTargetPixels != nullptr)
+            {
+                for (int y = 0; y < mPixelBufferHeight; ++y)
+                {
+                    memset(mTargetPixels + y * mTargetStride, 0, (size_t)mPixelBufferWidth * mPixelDepth);
+                }
+            }
+
+            mPixelBufferReset = false;
+            mMissedPaints = false;
+        }
+        else
+        {
+            mergeDirtyRects(dirtyRects);
         }
 
-        // if there is still a popup open, write it into the page too (it's pixels will have been
-        // copied into it's buffer by a call to OnPaint with type of PET_POPUP earlier)
+        if (zero_copy)
+        {
+            page_pixels = (const unsigned char*)buffer;
+            page_stride = width * mBufferDepth;
+            mPixelBufferStale = true;
+        }
+        else
+        {
+            // copy just the changed regions in (flipping in Y direction as per settings)
+            for (size_t i = 0; i < mDirtyRects.size(); ++i)
+            {
+                copyViewRect((const unsigned char*)buffer, mDirtyRects[i]);
+            }
+            mPixelBufferStale = false;
+        }
+
+        // if there is still a popup open and we just drew over it, write it into the page again (it's pixels
+        // will have been copied into it's buffer by a call to OnPaint with type of PET_POPUP earlier)
         if (mPopupBuffer != nullptr)
         {
-            copyPopupIntoView();
+            const CefRect popup_rect = clipToView(mPopupBufferRect);
+            for (size_t i = 0; i < mDirtyRects.size(); ++i)
+            {
+                if (!popup_rect.IsEmpty() && rectsTouch(mDirtyRects[i], popup_rect))
+                {
+                    copyPopupIntoView();
+                    mDirtyRects.push_back(popup_rect);
+                    break;
+                }
+            }
         }
     }
     // popup was updated
@@ -151,18 +623,214 @@ void dullahan_render_handler::OnPaint(CefRefPtr<CefBrowser> browser,
         // (popup buffer created in onPopupSize() as we know the size there)
         memcpy(mPopupBuffer, buffer, width * height * mBufferDepth);
 
+        // if we were handing out CEF's buffer or the view was just resized, ours doesn't have the
+        // page in it so wait for the view repaint that's coming and composite the popup then
+        if (mPixelBufferStale || mPixelBufferReset)
+        {
+            return;
+        }
+
         // copy over popup pixels into page pixels. We need this for when popup is changing (e.g. highlighting or scrolling)
         // when the containing page is not changing and therefore doesn't get an OnPaint update
         copyPopupIntoView();
+
+        const CefRect popup_rect = clipToView(mPopupBufferRect);
+        if (!popup_rect.IsEmpty())
+        {
+            mDirtyRects.push_back(popup_rect);
+        }
     }
 
     // if we have a buffer, indicate to consuming app that the page changed.
     if (mPixelBufferWidth > 0 && mPixelBufferHeight > 0)
     {
-        mParent->getCallbackManager()->onPageChanged(mPixelBuffer, 0, 0, mPixelBufferWidth, mPixelBufferHeight);
+        // consumer sees regions in pixel buffer coordinates which differ if we flipped
+        mPageDirtyRects.resize(mDirtyRects.size());
+        for (size_t i = 0; i < mDirtyRects.size(); ++i)
+        {
+            const CefRect& rect = mDirtyRects[i];
+            mPageDirtyRects[i].x = rect.x;
+            mPageDirtyRects[i].y = mFlipYPixels ? (mPixelBufferHeight - rect.y - rect.height) : rect.y;
+            mPageDirtyRects[i].width = rect.width;
+            mPageDirtyRects[i].height = rect.height;
+        }
+
+        deliverFrame(page_pixels, page_stride);
+    }
+}
+
+// pass the regions in mPageDirtyRects on to the consumer along with the page they are in
+void dullahan_render_handler::deliverFrame(const unsigned char* page_pixels, ptrdiff_t page_stride)
+{
+    // CEF repaints things like hidden carets and finished animations a lot - no
+    // point making the consumer upload a page it already has
+    if (mSuppressUnchangedFrames && !findChangedTiles(page_pixels, page_stride))
+    {
+        mParent->onPaintDamage(0, (int64_t)mPixelBufferWidth * mPixelBufferHeight);
+        return;
+    }
+
+    // tell the frame rate governor how busy the page is
+    int64_t damage_area = 0;
+    for (size_t i = 0; i < mPageDirtyRects.size(); ++i)
+    {
+        damage_area += (int64_t)mPageDirtyRects[i].width * mPageDirtyRects[i].height;
+    }
+    mParent->onPaintDamage(damage_area, (int64_t)mPixelBufferWidth * mPixelBufferHeight);
+
+    if (!mPageDirtyRects.empty())
+    {
+        ++mFrameSequence;
+        mDamageHistory[mFrameSequence % DAMAGE_HISTORY_SIZE] = mPageDirtyRects;
+
+        // copy it into the frame exchange so the consumer thread can pick it up
+        if (mFrameExchange != nullptr)
+        {
+            mFrameExchange->publish(page_pixels, page_stride, mPixelBufferWidth, mPixelBufferHeight,
+                                    mPixelFormat, mFrameSequence, mPageDirtyRects);
+        }
+    }
+
+    mParent->getCallbackManager()->onPageChanged(page_pixels, 0, 0, mPixelBufferWidth, mPixelBufferHeight);
+
+    if (!mPageDirtyRects.empty())
+    {
+        mParent->getCallbackManager()->onPageChangedRegions(page_pixels, mPixelBufferWidth, mPixelBufferHeight, mPageDirtyRects);
     }
 }
 
+void dullahan_render_handler::discardPixels()
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    // only worth keeping if our buffer has the whole page in it - a consumer
+    // buffer keeps its contents anyway since we stop writing to it
+    mSnapshot.clear();
+    if (mExternalBuffer.pixels == nullptr && mTargetPixels != nullptr && !mPixelBufferStale && !mPixelBufferReset)
+    {
+        dullahan_pixel_kernels::compressPixels(mTargetPixels, mTargetStride, mPixelBufferWidth, mPixelBufferHeight,
+                                               mPixelDepth, mSnapshot);
+        mSnapshot.shrink_to_fit();
+        mSnapshotWidth = mPixelBufferWidth;
+        mSnapshotHeight = mPixelBufferHeight;
+        mSnapshotFormat = mPixelFormat;
+
+        DLNOUT("Kept snapshot of page in " << mSnapshot.size() << " bytes");
+    }
+
+    // popups close along with the browser
+    delete[] mPopupBuffer;
+    mPopupBuffer = nullptr;
+    mPopupBufferRect.Set(0, 0, 0, 0);
+
+    mPixelBuffer.release();
+    mTargetPixels = nullptr;
+    mTargetStride = 0;
+
+    // a size of 0 means the next browser to ask gets the buffer created again
+    mPixelBufferWidth = 0;
+    mPixelBufferHeight = 0;
+    mPixelBufferStale = false;
+    mTileHashesValid = false;
+}
+
+void dullahan_render_handler::restorePixels()
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    // the new browser may not have asked for its size yet
+    int width, height;
+    mParent->getSize(width, height);
+    resizePixelBuffer(width, height);
+
+    if (!mSnapshot.empty() && mTargetPixels != nullptr &&
+        mSnapshotWidth == mPixelBufferWidth && mSnapshotHeight == mPixelBufferHeight && mSnapshotFormat == mPixelFormat &&
+        dullahan_pixel_kernels::decompressPixels(mSnapshot, mTargetPixels, mTargetStride,
+                                                 mPixelBufferWidth, mPixelBufferHeight, mPixelDepth))
+    {
+        // the buffer has a complete page in it again but the first
+        // paint from the new browser still has to replace all of it
+        mPixelBufferReset = false;
+        mMissedPaints = true;
+
+        if (mVisible)
+        {
+            dullahan::dullahan_rect everything;
+            everything.width = mPixelBufferWidth;
+            everything.height = mPixelBufferHeight;
+            mPageDirtyRects.assign(1, everything);
+            deliverFrame(mTargetPixels, mTargetStride);
+        }
+    }
+
+    mSnapshot.clear();
+    mSnapshot.shrink_to_fit();
+}
+
+size_t dullahan_render_handler::getMemoryFootprint()
+{
+    size_t bytes = mPixelBuffer.capacity() + mSnapshot.capacity();
+    if (mPopupBuffer != nullptr)
+    {
+        bytes += (size_t)mPopupBufferRect.width * mPopupBufferRect.height * mBufferDepth;
+    }
+
+    return bytes;
+}
+
+bool dullahan_render_handler::acquireFrame(uint64_t last_sequence, dullahan::dullahan_frame& frame)
+{
+    CEF_REQUIRE_UI_THREAD();
+
+    // nothing new or we don't have a complete copy of the page to give out
+    if (last_sequence >= mFrameSequence || mTargetPixels == nullptr || mPixelBufferStale || mPixelBufferReset)
+    {
+        return false;
+    }
+
+    frame.pixels = mTargetPixels;
+    frame.width = mPixelBufferWidth;
+    frame.height = mPixelBufferHeight;
+    frame.row_pitch = (int)mTargetStride;
+    frame.format = mPixelFormat;
+    frame.sequence = mFrameSequence;
+    frame.dirty_rects.clear();
+
+    // too far behind (or first time) so everything counts as changed
+    if (last_sequence == 0 || mFrameSequence - last_sequence > DAMAGE_HISTORY_SIZE)
+    {
+        dullahan::dullahan_rect everything;
+        everything.width = mPixelBufferWidth;
+        everything.height = mPixelBufferHeight;
+        frame.dirty_rects.push_back(everything);
+        return true;
+    }
+
+    for (uint64_t sequence = last_sequence + 1; sequence <= mFrameSequence; ++sequence)
+    {
+        const std::vector<dullahan::dullahan_rect>& damage = mDamageHistory[sequence % DAMAGE_HISTORY_SIZE];
+        for (size_t i = 0; i < damage.size(); ++i)
+        {
+            // regions from before a resize can hang off the edge of the page as it is now
+            dullahan::dullahan_rect rect = damage[i];
+            rect.width = std::min(rect.x + rect.width, mPixelBufferWidth) - rect.x;
+            rect.height = std::min(rect.y + rect.height, mPixelBufferHeight) - rect.y;
+            if (rect.width > 0 && rect.height > 0)
+            {
+                frame.dirty_rects.push_back(rect);
+            }
+        }
+    }
+
+    // lots of small uploads cost more than one bigger one
+    if (frame.dirty_rects.size() > MAX_DIRTY_RECTS)
+    {
+        collapseToBounds(frame.dirty_rects);
+    }
+
+    return true;
+}
+
 // CefRenderHandler override
 void dullahan_render_handler::OnPopupShow(CefRefPtr<CefBrowser> browser, bool show)
 {
@@ -175,6 +843,10 @@ void dullahan_render_handler::OnPopupShow(CefRefPtr<CefBrowser> browser, bool sh
         mPopupBuffer = nullptr;
 
         mPopupBufferRect.Set(0,0, 0,0);
+
+        // we only copy the parts of the view that change now so make sure
+        // the area that was under the popup gets painted again
+        browser->GetHost()->Invalidate(PET_VIEW);
     }
 }
 
@@ -183,11 +855,25 @@ void dullahan_render_handler::OnPopupSize(CefRefPtr<CefBrowser> browser, const C
 {
     CEF_REQUIRE_UI_THREAD();
 
+    // popups (e.g. a drop down list being filtered) can change size while they are open
+    if (mPopupBuffer != nullptr && (rect.width != mPopupBufferRect.width || rect.height != mPopupBufferRect.height))
+    {
+        delete[] mPopupBuffer;
+        mPopupBuffer = nullptr;
+    }
+
     mPopupBufferRect = rect;
     if (mPopupBuffer == nullptr)
     {
         mPopupBuffer = new unsigned char[rect.width * rect.height * mBufferDepth];
         memset(mPopupBuffer, 0xff, rect.width * rect.height * mBufferDepth);
+
+        // our copy of the page is out of date if we were passing CEF's buffer through
+        // so ask for the whole view again before we start compositing the popup
+        if (mPixelBufferStale)
+        {
+            browser->GetHost()->Invalidate(PET_VIEW);
+        }
     }
 }
 
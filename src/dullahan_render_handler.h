@@ -27,9 +27,16 @@
 #ifndef _DULLAHAN_RENDER_HANDLER
 #define _DULLAHAN_RENDER_HANDLER
 
+#include <cstdint>
+#include <vector>
+
 #include "cef_render_handler.h"
 
+#include "dullahan.h"
+#include "dullahan_aligned_buffer.h"
+
 class dullahan_impl;
+class dullahan_frame_exchange;
 
 class dullahan_render_handler :
     public CefRenderHandler
@@ -47,22 +54,103 @@ class dullahan_render_handler :
         void OnPopupSize(CefRefPtr<CefBrowser> browser, const CefRect& rect) override;
         bool GetScreenInfo(CefRefPtr<CefBrowser> browser, CefScreenInfo& screen_info) override;
 
+        // write pixels into memory owned by the consumer instead of our own buffer
+        void setExternalBuffer(const dullahan::dullahan_pixel_buffer& buffer);
+
+        // the page as it is now plus what changed since frame last_sequence
+        bool acquireFrame(uint64_t last_sequence, dullahan::dullahan_frame& frame);
+
+        // bytes we are holding on to for pixels
+        size_t getMemoryFootprint();
+
+        // stop copying pixels while nobody can see them or copy just the part they can
+        void setVisible(bool visible);
+        void setVisibleRegion(const CefRect& region);
+
+        // keep a compressed copy of the page and let go of the pixel buffers when the
+        // browser is discarded - then put it back and pass it on once there is a new one
+        void discardPixels();
+        void restorePixels();
+
         IMPLEMENT_REFCOUNTING(dullahan_render_handler);
 
     private:
         void resizePixelBuffer(int width, int height);
+        void selectPixelTarget();
+        bool externalBufferFits();
+        void mergeDirtyRects(const RectList& dirty_rects);
+        void copyViewRect(const unsigned char* src, const CefRect& rect);
         void copyPopupIntoView();
+        CefRect clipToView(const CefRect& rect);
+        CefRect clipToVisible(const CefRect& rect);
+        bool findChangedTiles(const unsigned char* pixels, ptrdiff_t stride);
+        void deliverFrame(const unsigned char* page_pixels, ptrdiff_t page_stride);
 
-        unsigned char* mPixelBuffer;
+        dullahan_aligned_buffer mPixelBuffer;
         int mPixelBufferWidth;
         int mPixelBufferHeight;
+
+        // buffer the consumer gave us, if any, and where pixels are written - that
+        // is either the start of the consumer's buffer or mPixelBuffer
+        dullahan::dullahan_pixel_buffer mExternalBuffer;
+        unsigned char* mTargetPixels;
+        ptrdiff_t mTargetStride;
         unsigned char* mPopupBuffer;
-        unsigned char* mPixelBufferRow;
         CefRect mPopupBufferRect;
         int mBufferDepth;
 
+        // pixels are converted from CEF's BGRA to this format as we copy them - it's the
+        // one from the settings unless the consumer's buffer asks for something else
+        dullahan::EPixelFormat mOutputPixelFormat;
+        dullahan::EPixelFormat mPixelFormat;
+        int mPixelDepth;
+
+        // set when the pixel buffer is (re)created so the next paint copies the whole view -
+        // until then the buffer holds whatever was in memory before so nobody gets to see it
+        bool mPixelBufferReset;
+
+        // regions changed by the current paint in view coordinates and the
+        // same regions in pixel buffer coordinates that we pass to the consumer
+        std::vector<CefRect> mDirtyRects;
+        std::vector<dullahan::dullahan_rect> mPageDirtyRects;
+
         bool mFlipYPixels;
 
+        // paints are ignored while hidden and only the visible region (in pixel buffer
+        // coordinates, empty for everything) is copied - anything skipped is remembered
+        // so the next paint copies the lot
+        bool mVisible;
+        CefRect mVisibleRegion;
+        bool mMissedPaints;
+
+        // hand CEF's buffer straight to the consumer when we can - the pixel buffer
+        // is then out of date and has to be refreshed before we composite into it
+        bool mZeroCopyFrames;
+        bool mPixelBufferStale;
+
+        // optional change detection - the page is split into tiles which are hashed after
+        // they are painted and paints that leave every tile the same are not passed on
+        bool mSuppressUnchangedFrames;
+        bool mTileHashesValid;
+        int mTileColumns;
+        int mTileRows;
+        std::vector<uint64_t> mTileHashes;
+        std::vector<unsigned char> mTileState;
+
+        // triple buffer finished frames are copied into - null unless enabled
+        dullahan_frame_exchange* mFrameExchange;
+
+        // every frame we pass on gets a number and we remember what changed in the
+        // last few so consumers that pull frames can catch up with one upload
+        uint64_t mFrameSequence;
+        std::vector<std::vector<dullahan::dullahan_rect>> mDamageHistory;
+
+        // run length encoded copy of the last frame kept while the browser is discarded
+        std::vector<unsigned char> mSnapshot;
+        int mSnapshotWidth;
+        int mSnapshotHeight;
+        dullahan::EPixelFormat mSnapshotFormat;
+
         dullahan_impl* mParent;
 };
 